@@ -0,0 +1,16 @@
+# Define FIRMWARE_BUILD, reported by the version command, as git describe
+# names the commit being built: its abbreviated hash, after the latest tag
+# if there is one, marked "-dirty" when the tree has changes. Builds from
+# outside a git checkout report "unknown".
+Import("env")
+
+import subprocess
+
+try:
+    build = subprocess.check_output(
+        ["git", "describe", "--always", "--dirty", "--abbrev=8"],
+        cwd=env.subst("$PROJECT_DIR")).decode().strip()
+except (OSError, subprocess.CalledProcessError):
+    build = "unknown"
+
+env.Append(CPPDEFINES=[("FIRMWARE_BUILD", env.StringifyMacro(build))])
@@ -0,0 +1,82 @@
+#include <Arduino.h>
+
+#include "clock.h"
+
+/**
+ * Timer1 runs with a prescaler of 8 so a tick is 1us at 8MHz and 0.5us on a
+ * 16MHz part.
+ */
+#define CLOCK_TICKS_PER_MICROSECOND (F_CPU / 8000000L)
+
+/**
+ * How much time passes between two Timer1 overflows, in microseconds and
+ * split into whole milliseconds plus the microseconds left over.
+ */
+#define CLOCK_OVERFLOW_MICROS (65536L / CLOCK_TICKS_PER_MICROSECOND)
+#define CLOCK_OVERFLOW_MILLIS (CLOCK_OVERFLOW_MICROS / 1000)
+#define CLOCK_OVERFLOW_FRACTION (CLOCK_OVERFLOW_MICROS % 1000)
+
+/**
+ * Time accumulated by the overflow interrupt. The microsecond count is kept
+ * separately from the millisecond count so that each wraps at 2^32 of its own
+ * unit like the Arduino equivalents do.
+ */
+static volatile uint32_t clock_overflow_micros = 0;
+static volatile uint32_t clock_overflow_millis = 0;
+static volatile uint16_t clock_overflow_fraction = 0;
+
+ISR(TIMER1_OVF_vect) {
+	clock_overflow_micros += CLOCK_OVERFLOW_MICROS;
+	clock_overflow_millis += CLOCK_OVERFLOW_MILLIS;
+	clock_overflow_fraction += CLOCK_OVERFLOW_FRACTION;
+	if(1000 <= clock_overflow_fraction) {
+		clock_overflow_fraction -= 1000;
+		clock_overflow_millis++;
+	}
+}
+
+void clock_begin() {
+	uint8_t sreg = SREG;
+	cli();
+	TCCR1A = 0;				// normal mode, no compare outputs
+	TCCR1B = _BV(CS11);		// prescaler of 8
+	TCNT1 = 0;
+	TIFR1 = _BV(TOV1);		// discard any overflow left from the core's setup
+	TIMSK1 = _BV(TOIE1);
+	SREG = sreg;
+}
+
+uint32_t clock_micros() {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t ticks = TCNT1;
+	uint32_t micros = clock_overflow_micros;
+	// an overflow that has happened but whose interrupt has not yet run
+	// (because we or the strip driver have interrupts disabled) must still be
+	// counted. A small count means the overflow happened before we read it.
+	if((TIFR1 & _BV(TOV1)) && ticks < 0x8000) {
+		micros += CLOCK_OVERFLOW_MICROS;
+	}
+	SREG = sreg;
+
+	return micros + ticks / CLOCK_TICKS_PER_MICROSECOND;
+}
+
+uint32_t clock_millis() {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t ticks = TCNT1;
+	uint32_t millis = clock_overflow_millis;
+	uint32_t fraction = clock_overflow_fraction;
+	if((TIFR1 & _BV(TOV1)) && ticks < 0x8000) {
+		millis += CLOCK_OVERFLOW_MILLIS;
+		fraction += CLOCK_OVERFLOW_FRACTION;
+	}
+	SREG = sreg;
+
+	return millis + (fraction + ticks / CLOCK_TICKS_PER_MICROSECOND) / 1000;
+}
+
+bool clock_reached(uint32_t deadline) {
+	return 0 <= (int32_t)(clock_millis() - deadline);
+}
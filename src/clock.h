@@ -0,0 +1,46 @@
+/**
+ *	A timebase for the firmware that does not lose time while the LED strip
+ *	is being written.
+ *
+ *	The Arduino core keeps `millis()` and `micros()` by counting Timer0
+ *	overflows in an interrupt. Writing to the strip must be done with
+ *	interrupts disabled and at 8MHz Timer0 overflows every 2048us; when an
+ *	update keeps interrupts off for longer than that the overflows in between
+ *	are simply lost and the Arduino clock falls behind. Timer1 is a 16 bit
+ *	timer which we run free at 1us per tick (8MHz / 8) so it overflows only
+ *	every 65.536ms. The AVR latches one pending overflow, which is counted by
+ *	a read of the clock only while the count is below half way, so any update
+ *	that keeps interrupts off for less than about 32ms is accounted for
+ *	exactly.
+ *
+ *	Note: this takes Timer1 away from `analogWrite` on pins 9 and 10.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+/**
+ * Start Timer1 free running. Must be called once from setup before any of
+ * the other clock functions are used.
+ */
+void clock_begin();
+
+/**
+ * Microseconds since clock_begin. Wraps after about 71 minutes.
+ */
+uint32_t clock_micros();
+
+/**
+ * Milliseconds since clock_begin. Wraps after about 49 days.
+ */
+uint32_t clock_millis();
+
+/**
+ * True once clock_millis has reached the deadline. Comparison is done on the
+ * signed difference so that it holds across the wrap of the millisecond count.
+ */
+bool clock_reached(uint32_t deadline);
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ *	Color conversions for effects, in integer arithmetic only.
+ *
+ *	Colors are packed as 0xWWRRGGBB as by Strip::Color.
+ *
+ *	@target Arduino Pro Mini (pro8MHzatmega328)
+ */
+
+#ifndef COLOR_H
+#define COLOR_H
+
+#include <stdint.h>
+
+#include "math8.h"
+
+/**
+ * Mix two colors, amount 0 giving from and 255 giving to
+ */
+inline uint32_t color_blend(uint32_t from, uint32_t to, uint8_t amount) {
+	uint32_t color = 0;
+	for(uint8_t shift = 0; shift < 32; shift += 8) {
+		uint8_t channel = lerp8(from >> shift, to >> shift, amount);
+		color |= (uint32_t)channel << shift;
+	}
+	return color;
+}
+
+/**
+ * Convert a color given as hue, saturation and value, each 0-255, to RGB.
+ * The hue wheel is split in six sectors, starting at red, in each of which
+ * one channel is full (value), one empty (value less saturation) and one
+ * ramps between the two. Finding the sector and the position in it takes a
+ * multiply and no division so the conversion takes a few dozen cycles and
+ * can be done per pixel.
+ */
+inline uint32_t hsv_color(uint8_t hue, uint8_t saturation, uint8_t value) {
+	uint16_t position = hue * 6;
+	uint8_t sector = position >> 8;
+	uint8_t rising = position;
+	uint8_t top = value;
+	uint8_t bottom = value - scale8(value, saturation);
+	uint8_t up = bottom + scale8(top - bottom, rising);
+	uint8_t down = bottom + scale8(top - bottom, ~rising);
+
+	uint8_t red, green, blue;
+	switch(sector) {
+		case 0: red = top; green = up; blue = bottom; break;
+		case 1: red = down; green = top; blue = bottom; break;
+		case 2: red = bottom; green = top; blue = up; break;
+		case 3: red = bottom; green = down; blue = top; break;
+		case 4: red = up; green = bottom; blue = top; break;
+		default: red = top; green = bottom; blue = down; break;
+	}
+	return ((uint32_t)red << 16) | ((uint16_t)green << 8) | blue;
+}
+
+#endif
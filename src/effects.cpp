@@ -0,0 +1,1235 @@
+#include <Arduino.h>
+
+#include "clock.h"
+#include "color.h"
+#include "effects.h"
+#include "math8.h"
+#include "persist.h"
+#if !LED_FRAMEBUFFER
+#include "procedural_strip.h"
+#elif 1 < LED_STRIPS
+#include "parallel_strip.h"
+#else
+#include "strip.h"
+#endif
+
+#if !LED_FRAMEBUFFER && 1 < LED_STRIPS
+#error "Rendering without a framebuffer supports a single strip"
+#endif
+
+#if !LED_FRAMEBUFFER && LED_DITHER
+#error "Dithering needs a framebuffer"
+#endif
+
+/**
+ * The number of pulse frames for the brightness to fall from
+ * MAX_PULSE_BRIGHTNESS to MIN_PULSE_BRIGHTNESS; the same again to rise
+ */
+#define PULSE_HALF_PERIOD_FRAMES \
+	((MAX_PULSE_BRIGHTNESS - MIN_PULSE_BRIGHTNESS) / PULSE_BRIGHTNESS_STEP)
+
+/**
+ * The length of a countdown's bar is kept in these fractions of an LED so the
+ * LED at its end can dim smoothly as it runs down
+ */
+#define COUNTDOWN_SUBSTEPS 16
+
+/**
+ * While an effect animates, channels below this 8 bit level are dithered and
+ * those at or above it rounded; a step of one level up there is under 3% and
+ * not seen
+ */
+#define DITHER_MAX_LEVEL 32
+
+/**
+ * Effect types; those from EFFECT_BLINK on are transient. Base effects are
+ * saved to EEPROM by type so bump SAVED_FORMAT if these are reordered.
+ */
+enum EffectType : uint8_t {
+	EFFECT_COLOR,
+	EFFECT_WIPE,
+	EFFECT_PULSE,
+	EFFECT_HUE,
+	EFFECT_CHASE,
+	EFFECT_COMET,
+	EFFECT_SPARKLE,
+	EFFECT_RAINBOW,
+	EFFECT_THEATER,
+	EFFECT_COUNTDOWN,
+	EFFECT_FADE,
+	EFFECT_GRADIENT,
+	EFFECT_BLINK,
+	EFFECT_FLASH,
+	EFFECT_ALERT
+};
+
+/**
+ * Everything needed to render an effect. Timed effects are made of `steps`
+ * equal steps where step k is due at start + k * duration / steps. Rendering
+ * against these absolute deadlines means the time spent showing a frame is
+ * absorbed and the effect ends on time.
+ *
+ * Animations (chase, comet, sparkle, rainbow and theater) run until replaced,
+ * advancing a frame every `duration` milliseconds; step is the frame within
+ * the animation's cycle and steps its length parameter, held for comet and
+ * rainbow as the fixed point step per LED (see effects_comet).
+ *
+ * A countdown's step is the length of its bar in COUNTDOWN_SUBSTEPS and steps
+ * is zero until it warns and then one more than the pulse frame.
+ */
+struct Effect {
+	EffectType type;
+	uint8_t priority;
+	uint16_t sequence;		// zero when the effect is not timed
+	uint32_t color;
+	uint32_t background;	// what a wipe wipes over; saturation and value for hue
+	uint32_t start;			// clock_millis when the effect started
+	uint32_t suspended;		// clock_millis when an effect was pushed over it
+	uint32_t duration;
+	uint32_t argument;		// ms a countdown warns before its end; fade easing
+	uint16_t steps;
+	uint16_t step;			// steps rendered so far; frame for pulse, hue for hue
+};
+
+/**
+ * A segment of the strip, LED_COUNT long, and its stack of effects; the
+ * effect running is at the top
+ */
+struct Segment {
+	Effect stack[EFFECT_STACK_DEPTH];
+	uint8_t top;
+};
+
+/**
+ *	Declare the interface to the strip of LED arrays; with several strips they
+ *	are driven in parallel and appear joined end to end
+ */
+#if !LED_FRAMEBUFFER
+static ProceduralStrip<LED_COUNT, LED_PIN, LED_FORMAT> strip;
+#elif 1 < LED_STRIPS
+static ParallelStrip<LED_COUNT, LED_STRIPS, LED_PIN, LED_FORMAT> strip;
+#else
+static Strip<LED_COUNT, LED_PIN, LED_FORMAT, 1 + LED_DOUBLE_BUFFER> strip;
+#endif
+
+/**
+ * One segment per strip
+ */
+static Segment segments[LED_STRIPS];
+
+/**
+ * The segment that effects are started on
+ */
+static uint8_t selected = 0;
+
+/**
+ * Whether a segment has been rendered since the strip was last shown
+ */
+static bool dirty = false;
+
+#if LED_DITHER
+/**
+ * The frame as rendered, each channel the product of its 8 bit value and the
+ * brightness, and what is dithered from it to the strip. Channels are in the
+ * order red, green, blue, white whatever the format.
+ */
+static uint16_t working[LED_COUNT * LED_STRIPS][LED_FORMAT::CHANNELS];
+
+/**
+ * Counts frames to step the dithering threshold; whether the last frame
+ * dithered had any channel between two levels and so needs to go on being
+ * shown
+ */
+static uint8_t dither_frame = 0;
+static bool dithering = false;
+#endif
+
+/**
+ * Frames shown since frame_rate_start, in clock_millis, the count for the
+ * last whole second, and how long the last frame took to send in us
+ */
+static uint16_t frames = 0;
+static uint16_t frame_rate = 0;
+static uint32_t frame_rate_start = 0;
+static uint32_t frame_micros = 0;
+static uint32_t shown_at = 0;
+
+/**
+ * A gradient; its stops, evenly spaced from its first LED to its last, and
+ * the change per LED of each channel from a stop towards the next in 8.8
+ * fixed point. These are worked out when it starts so that no LED needs a
+ * division.
+ */
+struct Gradient {
+	uint8_t stops;
+	uint16_t position[GRADIENT_MAX_STOPS];
+	uint8_t color[GRADIENT_MAX_STOPS][3];
+	int32_t slope[GRADIENT_MAX_STOPS - 1][3];
+};
+
+/**
+ * The gradient of each segment
+ */
+static Gradient gradients[LED_STRIPS];
+
+/**
+ * Bumped whenever SavedEffect or the order of EffectType changes, as the
+ * type is saved by value, so that a record saved by other firmware is not
+ * restored
+ */
+#define SAVED_FORMAT 1
+
+/**
+ * A base effect as saved to EEPROM; all that is needed to start it again.
+ * The stops of a gradient are kept as the colors and the LEDs the gradient
+ * spans, as effects_gradient takes them.
+ */
+struct SavedEffect {
+	EffectType type;
+	uint8_t priority;
+	uint32_t color;
+	uint32_t background;
+	uint32_t duration;
+	uint16_t steps;
+	uint8_t stops;
+	uint16_t first;
+	uint16_t last;
+	uint8_t colors[GRADIENT_MAX_STOPS][3];
+};
+
+struct SavedState {
+	uint8_t format;
+	SavedEffect segments[LED_STRIPS];
+};
+
+/**
+ * The state last saved or restored; persist reads it while writing
+ */
+static SavedState saved;
+
+#if LED_FRAMEBUFFER
+/**
+ * The frame a fade started from, as it was shown; red, green and blue then
+ * white, whatever the format
+ */
+static uint8_t fade_from[LED_STRIPS][LED_COUNT][LED_FORMAT::CHANNELS];
+#endif
+
+/**
+ * Whether showing the strip is held off; see effects_hold
+ */
+static bool held = false;
+
+/**
+ * Sequence number to give the next timed effect. Zero is skipped on wrap as
+ * it marks an effect that is not timed.
+ */
+static uint16_t next_sequence = 1;
+
+/**
+ * Whether effects of lower priority than the running effect are queued or
+ * dropped
+ */
+static bool queue_lower_priority = true;
+
+/**
+ * The priority an effect is to run at; that given or, for PRIORITY_DEFAULT,
+ * the default for its type
+ */
+static uint8_t resolve_priority(EffectType type, uint8_t priority) {
+	if(PRIORITY_DEFAULT != priority) {
+		return priority;
+	}
+
+	switch(type) {
+		case EFFECT_BLINK:
+		case EFFECT_FLASH:
+			return PRIORITY_STATUS;
+		case EFFECT_ALERT:
+			return PRIORITY_ALERT;
+		default:
+			return PRIORITY_AMBIENT;
+	}
+}
+
+static bool is_transient(const Effect & effect) {
+	return EFFECT_BLINK <= effect.type;
+}
+
+/**
+ * The brightness of a pulse at a frame; it falls from max to min then rises
+ * back again
+ */
+static uint8_t pulse_brightness(uint16_t frame) {
+	uint16_t phase = frame % (2 * PULSE_HALF_PERIOD_FRAMES);
+	if(phase < PULSE_HALF_PERIOD_FRAMES) {
+		return MAX_PULSE_BRIGHTNESS - phase * PULSE_BRIGHTNESS_STEP;
+	}
+	return MIN_PULSE_BRIGHTNESS
+			+ (phase - PULSE_HALF_PERIOD_FRAMES) * PULSE_BRIGHTNESS_STEP;
+}
+
+/**
+ * The brightness the effect is shown at for the step it has reached
+ */
+static uint8_t effect_brightness(const Effect & effect) {
+	if(EFFECT_PULSE == effect.type) {
+		return pulse_brightness(effect.step);
+	} else if(EFFECT_COUNTDOWN == effect.type && 0 < effect.steps) {
+		return pulse_brightness(effect.steps - 1);
+	} else if(EFFECT_FADE == effect.type) {
+		// a fade works in the brightness of the frame shown
+		return 255;
+	}
+	return DEFAULT_BRIGHTNESS;
+}
+
+/**
+ * Apply an easing curve, one of the EASE_ constants, to a fraction
+ */
+static uint8_t ease(uint8_t easing, uint8_t fraction) {
+	switch(easing) {
+		case EASE_IN:
+			return ease8_in_quad(fraction);
+		case EASE_OUT:
+			return ease8_out_quad(fraction);
+		case EASE_IN_OUT:
+			return ease8_in_out_cubic(fraction);
+		default:
+			return fraction;
+	}
+}
+
+/**
+ * A round of a 16 bit xorshift generator; from any seed but zero it visits
+ * every other value before repeating
+ */
+static uint16_t xorshift16(uint16_t x) {
+	x ^= x << 7;
+	x ^= x >> 9;
+	x ^= x << 8;
+	return x;
+}
+
+/**
+ * How far the i-th LED is behind the head of a chase or comet, which is at
+ * the LED given by the step and wraps round the end of the segment
+ */
+static uint16_t behind_head(const Effect & effect, uint16_t i) {
+	return (i <= effect.step) ? effect.step - i
+			: effect.step + LED_COUNT - i;
+}
+
+/**
+ * The color of the i-th LED of the segment for the step the effect has
+ * reached. It depends on nothing else so without a framebuffer it can be
+ * worked out as each pixel is sent; it must then be quick (see
+ * procedural_strip.h).
+ */
+static uint32_t effect_pixel(const Effect & effect, uint8_t segment,
+		uint16_t i) {
+	// the index of the latest step rendered
+	uint16_t index = (0 < effect.step) ? effect.step - 1 : 0;
+
+	switch(effect.type) {
+		case EFFECT_WIPE:
+			return (i < effect.step) ? effect.color : effect.background;
+		case EFFECT_BLINK:
+			// each repeat is an off step followed by an on step
+			return (index & 1) ? effect.color : 0;
+		case EFFECT_ALERT:
+			// each repeat is an on step followed by an off step
+			return (index & 1) ? 0 : effect.color;
+		case EFFECT_CHASE:
+			return (behind_head(effect, i) < effect.steps)
+					? effect.color : effect.background;
+		case EFFECT_COMET: {
+			// the tail fades linearly in 8.8 fixed point then eased so it
+			// falls away quickly behind the head
+			uint32_t fall = (uint32_t)behind_head(effect, i) * effect.steps;
+			if(0xFFFF < fall) {
+				return effect.background;
+			}
+			uint8_t level = (0xFFFF - fall) >> 8;
+			return color_blend(effect.background, effect.color,
+					ease8_in_quad(level));
+		}
+		case EFFECT_SPARKLE: {
+			// a sparkle is random in LED and frame but the same every
+			// time a frame is rendered so no state is kept
+			uint16_t x = ((i + 1) * 0x9E37u) ^ (effect.step * 0x3C6Fu);
+			x = xorshift16(xorshift16(x));
+			return ((uint8_t)x < effect.steps) ? effect.color
+					: effect.background;
+		}
+		case EFFECT_RAINBOW: {
+			uint8_t hue = ((uint32_t)i * effect.steps >> 8) + effect.step;
+			return hsv_color(hue, 255, 255);
+		}
+		case EFFECT_THEATER:
+			return (i % effect.steps == effect.step) ? effect.color
+					: effect.background;
+		case EFFECT_COUNTDOWN: {
+			// the bar in the warning color once warning; the LED at its end
+			// lit in proportion to how much of it is left
+			uint32_t color = (0 < effect.steps) ? effect.background
+					: effect.color;
+			uint16_t whole = effect.step / COUNTDOWN_SUBSTEPS;
+			if(i < whole) {
+				return color;
+			} else if(i > whole) {
+				return 0;
+			}
+			return color_blend(0, color, (effect.step % COUNTDOWN_SUBSTEPS)
+					* 255 / (COUNTDOWN_SUBSTEPS - 1));
+		}
+		case EFFECT_FADE: {
+			// step runs from 0 to 255 along the easing curve from the frame
+			// shown when the fade started to the color at the brightness
+			// it is left at; without a framebuffer from the color of the
+			// effect that was shown
+			uint8_t fraction = ease(effect.argument, effect.step);
+			uint32_t color = 0;
+			for(uint8_t j = 0; j < LED_FORMAT::CHANNELS; j++) {
+				uint8_t shift = ((2 - j) & 3) * 8;
+				uint8_t to = scale8(effect.color >> shift, DEFAULT_BRIGHTNESS);
+#if LED_FRAMEBUFFER
+				uint8_t from = fade_from[segment][i][j];
+#else
+				uint8_t from = scale8(effect.background >> shift,
+						DEFAULT_BRIGHTNESS);
+#endif
+				color |= (uint32_t)lerp8(from, to, fraction) << shift;
+			}
+			return color;
+		}
+		case EFFECT_GRADIENT: {
+			// outside the gradient what was there before shows through
+			const Gradient & gradient = gradients[segment];
+			if(i < gradient.position[0]
+					|| i > gradient.position[gradient.stops - 1]) {
+				return effect.background;
+			}
+			uint8_t k = 0;
+			while(k + 2 < gradient.stops && i >= gradient.position[k + 1]) {
+				k++;
+			}
+			uint16_t offset = i - gradient.position[k];
+			uint32_t color = 0;
+			for(uint8_t j = 0; j < 3; j++) {
+				int32_t value = ((int32_t)gradient.color[k][j] << 8)
+						+ gradient.slope[k][j] * offset + 0x80;
+				color = (color << 8) | (uint8_t)(value >> 8);
+			}
+			return color;
+		}
+		default:
+			return effect.color;
+	}
+}
+
+/**
+ * Render the frame of the effect for the step it has reached into its
+ * segment. The strip is shown by effects_update; without a framebuffer there
+ * is nothing to render and it is shaded from the running effect then.
+ */
+static void render(const Segment & segment, const Effect & effect) {
+#if LED_DITHER
+	uint8_t index = &segment - segments;
+	uint16_t first = index * LED_COUNT;
+	uint16_t brightness = effect_brightness(effect) + 1;
+	for(uint16_t i = 0; i < LED_COUNT; i++) {
+		uint32_t color = effect_pixel(effect, index, i);
+		uint16_t * channels = working[first + i];
+		for(uint8_t j = 0; j < LED_FORMAT::CHANNELS; j++) {
+			// red, green and blue then white are bytes 2, 1, 0 and 3
+			channels[j] = (uint8_t)(color >> ((2 - j) & 3) * 8) * brightness;
+		}
+	}
+#elif LED_FRAMEBUFFER
+	uint8_t index = &segment - segments;
+	uint16_t first = index * LED_COUNT;
+	strip.setBrightness(effect_brightness(effect));
+	for(uint16_t i = 0; i < LED_COUNT; i++) {
+		strip.setPixelColor(first + i, effect_pixel(effect, index, i));
+	}
+#endif
+	dirty = true;
+}
+
+/**
+ * Whether the running effect of every segment is still; one that shows the
+ * same frame until replaced
+ */
+static bool still() {
+	for(uint8_t i = 0; i < LED_STRIPS; i++) {
+		EffectType type = segments[i].stack[segments[i].top].type;
+		if(EFFECT_COLOR != type && EFFECT_GRADIENT != type) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#if LED_DITHER
+/**
+ * Write the working frame to the strip rounded to 8 bits by ordered temporal
+ * dithering. Each frame every channel is rounded up when its fraction exceeds
+ * a threshold that visits eight evenly spread values in bit reversed order
+ * over eight frames, so on average the LED shows the 16 bit value. Each pixel
+ * starts at a different point so that they do not all step together.
+ *
+ * Dithering is for the steps of a fade or pulse through low levels so only
+ * channels below DITHER_MAX_LEVEL are dithered, and only while some effect
+ * animates. Otherwise channels are rounded and once nothing changes the
+ * frame is sent once and left.
+ */
+static void dither() {
+	bool animating = !still();
+	uint8_t bits = dither_frame++ & 7;
+	uint8_t threshold = ((bits & 1) << 7) | ((bits & 2) << 5)
+			| ((bits & 4) << 3);
+	dithering = false;
+	for(uint16_t n = 0; n < LED_COUNT * LED_STRIPS; n++) {
+		uint8_t offset = threshold + n * 37;
+		uint8_t out[4] = {0, 0, 0, 0};
+		for(uint8_t j = 0; j < LED_FORMAT::CHANNELS; j++) {
+			uint16_t value = working[n][j];
+			// at most 255 * 256 so adding a byte can not overflow
+			if(!animating || DITHER_MAX_LEVEL <= value >> 8) {
+				out[j] = (value + 0x80) >> 8;
+			} else {
+				out[j] = (value + offset) >> 8;
+				dithering |= 0 != (uint8_t)value;
+			}
+		}
+		strip.setPixelColor(n, strip.Color(out[0], out[1], out[2], out[3]));
+	}
+}
+#endif
+
+/**
+ * Send the "done" event for an effect if it is timed
+ */
+static void finish_effect(Effect & effect, bool preempted) {
+	if(0 != effect.sequence) {
+		Serial.print("done ");
+		Serial.print(effect.sequence);
+		Serial.println(preempted ? " preempted" : "");
+		effect.sequence = 0;
+	}
+}
+
+static void init_effect(Effect & effect, EffectType type, uint32_t color,
+		uint8_t priority, bool timed) {
+	effect.type = type;
+	effect.priority = priority;
+	effect.sequence = 0;
+	effect.color = color;
+	effect.start = clock_millis();
+	// an effect queued beneath others starts when it is resumed
+	effect.suspended = effect.start;
+	effect.duration = 0;
+	effect.argument = 0;
+	effect.steps = 0;
+	effect.step = 0;
+	if(timed) {
+		effect.sequence = next_sequence++;
+		if(0 == next_sequence) {
+			next_sequence = 1;
+		}
+	}
+}
+
+/**
+ * Start a new base effect. If it outranks the running effect everything on
+ * the stack is pre-empted; otherwise, if queueing, the old base effect is
+ * replaced along with any transient effects the new one outranks, so that
+ * the stack stays in priority order, and the new one waits beneath the rest.
+ * The old base effect's color is kept as the new one's background. Returns
+ * NULL when the effect is dropped.
+ */
+static Effect * start_base(Segment & segment, EffectType type,
+		uint32_t color, uint8_t priority, bool timed) {
+	Effect * stack = segment.stack;
+	uint8_t & top = segment.top;
+	priority = resolve_priority(type, priority);
+	if(priority >= stack[top].priority) {
+		for(; 0 < top; top--) {
+			finish_effect(stack[top], true);
+		}
+	} else if(!queue_lower_priority || priority < stack[0].priority) {
+		return NULL;
+	} else {
+		uint8_t kept = 0;
+		for(uint8_t i = 1; i <= top; i++) {
+			if(priority > stack[i].priority) {
+				finish_effect(stack[i], true);
+			} else {
+				stack[++kept] = stack[i];
+			}
+		}
+		top = kept;
+	}
+	finish_effect(stack[0], true);
+
+	stack[0].background = stack[0].color;
+	init_effect(stack[0], type, color, priority, timed);
+	return &stack[0];
+}
+
+/**
+ * Start a transient effect. If it outranks the running effect the running
+ * effect is suspended and the new one pushed over it; when the stack is full
+ * the running effect is pre-empted and replaced instead. Otherwise, if
+ * queueing, it is inserted beneath the effects that outrank it. Returns NULL
+ * when the effect is dropped.
+ */
+static Effect * start_transient(Segment & segment, EffectType type,
+		uint32_t color, uint8_t priority) {
+	Effect * stack = segment.stack;
+	uint8_t & top = segment.top;
+	priority = resolve_priority(type, priority);
+	uint8_t index;
+	if(priority >= stack[top].priority) {
+		if(EFFECT_STACK_DEPTH - 1 == top) {
+			finish_effect(stack[top], true);
+		} else {
+			stack[top].suspended = clock_millis();
+			top++;
+		}
+		index = top;
+	} else {
+		if(!queue_lower_priority || EFFECT_STACK_DEPTH - 1 == top) {
+			return NULL;
+		}
+		for(index = top; 0 < index && priority < stack[index - 1].priority;
+				index--) {
+		}
+		if(0 == index) {
+			// the base effect itself outranks it so it could never run
+			return NULL;
+		}
+		for(uint8_t i = top + 1; i > index; i--) {
+			stack[i] = stack[i - 1];
+		}
+		top++;
+	}
+
+	init_effect(stack[index], type, color, priority, true);
+	return &stack[index];
+}
+
+/**
+ * Drop the finished transient effect and resume the one below, shifting its
+ * start by the time it was suspended so it carries on where it left off. A
+ * countdown is of real time so it is not shifted; it has run on meanwhile.
+ */
+static void pop_transient(Segment & segment) {
+	segment.top--;
+	Effect & effect = segment.stack[segment.top];
+	if(EFFECT_COUNTDOWN != effect.type) {
+		effect.start += clock_millis() - effect.suspended;
+	}
+	render(segment, effect);
+}
+
+/**
+ * Send the frame to the strip; without a framebuffer it is shaded from the
+ * running effect of the one segment
+ */
+static void show() {
+#if LED_DITHER
+	dither();
+#endif
+
+	// wait out the latch here so that what is timed is the sending alone
+	while(clock_micros() - shown_at < STRIP_LATCH_MICROS) {
+	}
+	uint32_t started = clock_micros();
+#if LED_FRAMEBUFFER
+	strip.show();
+#else
+	const Effect & effect = segments[0].stack[segments[0].top];
+	strip.setBrightness(effect_brightness(effect));
+	strip.show([&effect](uint16_t i) {
+		return effect_pixel(effect, 0, i);
+	});
+#endif
+	shown_at = clock_micros();
+	frame_micros = shown_at - started;
+	frames++;
+	dirty = false;
+}
+
+/**
+ * Start the base effect of each segment as saved, where it is one that can
+ * run; nothing is started if there is no saved state
+ */
+static void restore_saved() {
+	if(!persist_load(&saved, sizeof(saved)) || SAVED_FORMAT != saved.format) {
+		return;
+	}
+
+	for(selected = 0; selected < LED_STRIPS; selected++) {
+		const SavedEffect & effect = saved.segments[selected];
+		Segment & segment = segments[selected];
+		if(EFFECT_GRADIENT == effect.type) {
+			effects_gradient(effect.first, effect.last, effect.colors,
+					effect.stops, effect.priority);
+		} else if(EFFECT_HUE == effect.type && 0 != effect.duration) {
+			effects_hue(effect.duration, effect.background >> 8,
+					effect.background, effect.priority);
+		} else if(EFFECT_COLOR == effect.type || EFFECT_PULSE == effect.type
+				|| (EFFECT_CHASE <= effect.type && EFFECT_THEATER >= effect.type
+				&& 0 != effect.duration && 0 != effect.steps)) {
+			Effect * started = start_base(segment, effect.type, effect.color,
+					effect.priority, false);
+			started->duration = effect.duration;
+			started->steps = effect.steps;
+			render(segment, *started);
+		}
+	}
+	selected = 0;
+}
+
+void effects_begin() {
+	strip.begin();
+#if LED_DITHER
+	// the brightness is in the working frame
+	strip.setBrightness(255);
+#endif
+	for(selected = LED_STRIPS; 0 < selected; ) {
+		selected--;
+		effects_color(0, 0, 0, 0, PRIORITY_AMBIENT);
+	}
+	restore_saved();
+	show();
+}
+
+void effects_save() {
+	SavedState state;
+	memset(&state, 0, sizeof(state));
+	state.format = SAVED_FORMAT;
+	for(uint8_t i = 0; i < LED_STRIPS; i++) {
+		const Effect & effect = segments[i].stack[0];
+		SavedEffect & kept = state.segments[i];
+		kept.type = effect.type;
+		kept.priority = effect.priority;
+		kept.color = effect.color;
+		switch(effect.type) {
+			case EFFECT_WIPE:
+			case EFFECT_FADE:
+				kept.type = EFFECT_COLOR;
+				break;
+			case EFFECT_COUNTDOWN:
+				kept.type = EFFECT_COLOR;
+				kept.color = 0;
+				break;
+			case EFFECT_HUE:
+				// the color turns with the hue; it starts again from red
+				kept.color = 0;
+				kept.background = effect.background;
+				kept.duration = effect.duration;
+				break;
+			case EFFECT_CHASE:
+			case EFFECT_COMET:
+			case EFFECT_SPARKLE:
+			case EFFECT_RAINBOW:
+			case EFFECT_THEATER:
+				kept.duration = effect.duration;
+				kept.steps = effect.steps;
+				break;
+			case EFFECT_GRADIENT: {
+				const Gradient & gradient = gradients[i];
+				kept.stops = gradient.stops;
+				kept.first = gradient.position[0];
+				kept.last = gradient.position[gradient.stops - 1];
+				memcpy(kept.colors, gradient.color, sizeof(kept.colors));
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	if(0 != memcmp(&state, &saved, sizeof(state))) {
+		saved = state;
+		persist_save(&saved, sizeof(saved));
+	}
+}
+
+bool effects_select_segment(uint8_t segment) {
+	if(LED_STRIPS <= segment) {
+		return false;
+	}
+
+	selected = segment;
+	return true;
+}
+
+void effects_set_queue_policy(bool queue) {
+	queue_lower_priority = queue;
+}
+
+void effects_hold(bool hold) {
+	held = hold;
+}
+
+bool effects_pending(uint16_t sequence) {
+	for(uint8_t i = 0; i < LED_STRIPS && 0 != sequence; i++) {
+		for(uint8_t j = 0; j <= segments[i].top; j++) {
+			if(sequence == segments[i].stack[j].sequence) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool effects_idle() {
+#if LED_DITHER
+	if(dithering) {
+		return false;
+	}
+#endif
+	return still() && !dirty;
+}
+
+uint16_t effects_frame_rate() {
+	return frame_rate;
+}
+
+uint16_t effects_max_frame_rate() {
+	return 1000000L / (frame_micros + STRIP_LATCH_MICROS);
+}
+
+void effects_cancel() {
+	Segment & segment = segments[selected];
+	finish_effect(segment.stack[segment.top], true);
+	if(0 < segment.top) {
+		pop_transient(segment);
+	} else {
+		init_effect(segment.stack[0], EFFECT_COLOR, 0, PRIORITY_AMBIENT,
+				false);
+		render(segment, segment.stack[0]);
+	}
+}
+
+uint16_t effects_blink(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t duration, uint16_t repeats, uint8_t priority) {
+	Effect * effect = start_transient(segments[selected], EFFECT_BLINK,
+			strip.Color(red, green, blue), priority);
+	if(NULL == effect) {
+		return 0;
+	}
+
+	effect->duration = duration;
+	effect->steps = 2 * repeats;
+	return effect->sequence;
+}
+
+uint16_t effects_flash(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t duration, uint8_t priority) {
+	Effect * effect = start_transient(segments[selected], EFFECT_FLASH,
+			strip.Color(red, green, blue), priority);
+	if(NULL == effect) {
+		return 0;
+	}
+
+	effect->duration = duration;
+	effect->steps = 1;
+	return effect->sequence;
+}
+
+uint16_t effects_alert(uint8_t red, uint8_t green, uint8_t blue,
+		uint16_t repeats, uint8_t priority) {
+	Effect * effect = start_transient(segments[selected], EFFECT_ALERT,
+			strip.Color(red, green, blue), priority);
+	if(NULL == effect) {
+		return 0;
+	}
+
+	effect->duration = 2 * (uint32_t)repeats * ALERT_PHASE_PERIOD;
+	effect->steps = 2 * repeats;
+	return effect->sequence;
+}
+
+uint16_t effects_wipe(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t duration, uint8_t priority) {
+	Effect * effect = start_base(segments[selected], EFFECT_WIPE,
+			strip.Color(red, green, blue), priority, true);
+	if(NULL == effect) {
+		return 0;
+	}
+
+	effect->duration = duration;
+	effect->steps = LED_COUNT;
+	return effect->sequence;
+}
+
+bool effects_color(uint8_t red, uint8_t green, uint8_t blue, uint8_t white,
+		uint8_t priority) {
+	Segment & segment = segments[selected];
+	Effect * effect = start_base(segment, EFFECT_COLOR,
+			strip.Color(red, green, blue, white), priority, false);
+	if(NULL == effect) {
+		return false;
+	}
+
+	if(0 == segment.top) {
+		render(segment, *effect);
+	}
+	return true;
+}
+
+bool effects_hue(uint32_t period, uint8_t saturation, uint8_t value,
+		uint8_t priority) {
+	Segment & segment = segments[selected];
+	Effect * effect = start_base(segment, EFFECT_HUE,
+			hsv_color(0, saturation, value), priority, false);
+	if(NULL == effect) {
+		return false;
+	}
+
+	effect->background = ((uint16_t)saturation << 8) | value;
+	effect->duration = period;
+	if(0 == segment.top) {
+		render(segment, *effect);
+	}
+	return true;
+}
+
+/**
+ * Start an animation as a new base effect
+ */
+static bool start_animation(EffectType type, uint32_t color, uint32_t period,
+		uint16_t steps, uint8_t priority) {
+	Segment & segment = segments[selected];
+	Effect * effect = start_base(segment, type, color, priority, false);
+	if(NULL == effect) {
+		return false;
+	}
+
+	effect->duration = period;
+	effect->steps = steps;
+	if(0 == segment.top) {
+		render(segment, *effect);
+	}
+	return true;
+}
+
+bool effects_chase(uint8_t red, uint8_t green, uint8_t blue, uint32_t period,
+		uint16_t length, uint8_t priority) {
+	return start_animation(EFFECT_CHASE, strip.Color(red, green, blue),
+			period, length, priority);
+}
+
+bool effects_comet(uint8_t red, uint8_t green, uint8_t blue, uint32_t period,
+		uint16_t length, uint8_t priority) {
+	// the fall in brightness per LED of tail in 8.8 fixed point
+	return start_animation(EFFECT_COMET, strip.Color(red, green, blue),
+			period, 0xFFFF / length, priority);
+}
+
+bool effects_sparkle(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t period, uint8_t density, uint8_t priority) {
+	return start_animation(EFFECT_SPARKLE, strip.Color(red, green, blue),
+			period, density, priority);
+}
+
+bool effects_rainbow(uint32_t period, uint16_t length, uint8_t priority) {
+	// the change in hue per LED in 8.8 fixed point
+	return start_animation(EFFECT_RAINBOW, hsv_color(0, 255, 255), period,
+			0xFFFF / length, priority);
+}
+
+bool effects_theater(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t period, uint8_t spacing, uint8_t priority) {
+	return start_animation(EFFECT_THEATER, strip.Color(red, green, blue),
+			period, spacing, priority);
+}
+
+uint16_t effects_countdown(uint32_t duration, uint8_t red, uint8_t green,
+		uint8_t blue, uint32_t warning, uint8_t warning_red,
+		uint8_t warning_green, uint8_t warning_blue, uint8_t priority) {
+	Segment & segment = segments[selected];
+	Effect * effect = start_base(segment, EFFECT_COUNTDOWN,
+			strip.Color(red, green, blue), priority, true);
+	if(NULL == effect) {
+		return 0;
+	}
+
+	effect->background = strip.Color(warning_red, warning_green, warning_blue);
+	effect->duration = duration;
+	effect->argument = warning;
+	effect->step = LED_COUNT * COUNTDOWN_SUBSTEPS;
+	if(0 == segment.top) {
+		render(segment, *effect);
+	}
+	return effect->sequence;
+}
+
+uint16_t effects_fade(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t duration, uint8_t easing, uint8_t priority) {
+	Segment & segment = segments[selected];
+	// what is shown now, which starting the fade may replace
+	Effect shown = segment.stack[segment.top];
+	Effect * effect = start_base(segment, EFFECT_FADE,
+			strip.Color(red, green, blue), priority, true);
+	if(NULL == effect) {
+		return 0;
+	}
+
+#if LED_FRAMEBUFFER
+	uint8_t brightness = effect_brightness(shown);
+	for(uint16_t i = 0; i < LED_COUNT; i++) {
+		uint32_t color = effect_pixel(shown, selected, i);
+		for(uint8_t j = 0; j < LED_FORMAT::CHANNELS; j++) {
+			fade_from[selected][i][j] = scale8(color >> ((2 - j) & 3) * 8,
+					brightness);
+		}
+	}
+#else
+	effect->background = shown.color;
+#endif
+	effect->duration = duration;
+	effect->argument = easing;
+	effect->steps = 255;
+	return effect->sequence;
+}
+
+bool effects_gradient(uint16_t first, uint16_t last,
+		const uint8_t colors[][3], uint8_t stops, uint8_t priority) {
+	if(stops < 2 || GRADIENT_MAX_STOPS < stops || LED_COUNT <= last
+			|| last < first || last - first < stops - 1) {
+		return false;
+	}
+
+	Segment & segment = segments[selected];
+	Effect * effect = start_base(segment, EFFECT_GRADIENT, 0, priority,
+			false);
+	if(NULL == effect) {
+		return false;
+	}
+
+	// the pixel function of a gradient queued beneath a transient effect is
+	// not called until the transient effect ends, so its stops may be
+	// replaced straight away
+	Gradient & gradient = gradients[selected];
+	gradient.stops = stops;
+	for(uint8_t k = 0; k < stops; k++) {
+		gradient.position[k] = first
+				+ (uint32_t)(last - first) * k / (stops - 1);
+		for(uint8_t j = 0; j < 3; j++) {
+			gradient.color[k][j] = colors[k][j];
+		}
+	}
+	for(uint8_t k = 0; k + 1 < stops; k++) {
+		uint16_t length = gradient.position[k + 1] - gradient.position[k];
+		for(uint8_t j = 0; j < 3; j++) {
+			gradient.slope[k][j] = ((int32_t)colors[k + 1][j] - colors[k][j])
+					* 256 / length;
+		}
+	}
+
+	if(0 == segment.top) {
+		render(segment, *effect);
+	}
+	return true;
+}
+
+bool effects_pulse(uint8_t priority) {
+	Segment & segment = segments[selected];
+	Effect * effect = start_base(segment, EFFECT_PULSE,
+			segment.stack[0].color, priority, false);
+	if(NULL == effect) {
+		return false;
+	}
+
+	if(0 == segment.top) {
+		render(segment, *effect);
+	}
+	return true;
+}
+
+/**
+ * A timed effect has run its course. Transient effects give way to the
+ * effect below; a wipe leaves the strip its color.
+ */
+static void complete_effect(Segment & segment, Effect & effect) {
+	finish_effect(effect, false);
+	if(is_transient(effect)) {
+		pop_transient(segment);
+	} else {
+		effect.type = EFFECT_COLOR;
+		render(segment, effect);
+	}
+}
+
+/**
+ * Milliseconds after the start of a timed effect at which a step is due;
+ * duration * step / steps split so the product can not overflow
+ */
+static uint32_t step_offset(const Effect & effect, uint16_t step) {
+	return (effect.duration / effect.steps) * step
+			+ (effect.duration % effect.steps) * step / effect.steps;
+}
+
+static void update_timed_effect(Segment & segment, Effect & effect) {
+	uint32_t elapsed = clock_millis() - effect.start;
+	if(effect.duration <= elapsed) {
+		complete_effect(segment, effect);
+		return;
+	}
+
+	// advance over every step whose deadline has passed; should we have
+	// fallen behind only the latest frame is shown
+	uint16_t step = effect.step;
+	while(step < effect.steps
+			&& step_offset(effect, step) <= elapsed) {
+		step++;
+	}
+	if(step != effect.step) {
+		effect.step = step;
+		render(segment, effect);
+	}
+}
+
+static void update_pulse(Segment & segment, Effect & effect) {
+	uint16_t frame = (clock_millis() - effect.start) / PULSE_FRAME_PERIOD;
+	if(frame != effect.step) {
+		effect.step = frame;
+		render(segment, effect);
+	}
+}
+
+/**
+ * Move the hue round the wheel, once per period
+ */
+static void update_hue(Segment & segment, Effect & effect) {
+	uint32_t elapsed = clock_millis() - effect.start;
+	uint8_t hue = (elapsed % effect.duration) * 256 / effect.duration;
+	if(hue != effect.step) {
+		effect.step = hue;
+		effect.color = hsv_color(hue, effect.background >> 8,
+				effect.background);
+		render(segment, effect);
+	}
+}
+
+/**
+ * Advance an animation to the frame that is due; frames count round the
+ * animation's cycle so the step never wraps part way through
+ */
+static void update_animation(Segment & segment, Effect & effect) {
+	uint32_t frame = (clock_millis() - effect.start) / effect.duration;
+	switch(effect.type) {
+		case EFFECT_CHASE:
+		case EFFECT_COMET:
+			frame %= LED_COUNT;
+			break;
+		case EFFECT_RAINBOW:
+			frame %= 256;
+			break;
+		case EFFECT_THEATER:
+			frame %= effect.steps;
+			break;
+		default:
+			break;
+	}
+	if((uint16_t)frame != effect.step) {
+		effect.step = frame;
+		render(segment, effect);
+	}
+}
+
+/**
+ * Shorten a countdown's bar in proportion to the time remaining and pulse it
+ * once warning. At the end the segment is left dark.
+ */
+static void update_countdown(Segment & segment, Effect & effect) {
+	uint32_t elapsed = clock_millis() - effect.start;
+	if(effect.duration <= elapsed) {
+		finish_effect(effect, false);
+		effect.type = EFFECT_COLOR;
+		effect.color = 0;
+		render(segment, effect);
+		return;
+	}
+
+	uint32_t remaining = effect.duration - elapsed;
+	uint16_t frame = 0;
+	if(remaining <= effect.argument) {
+		frame = 1 + ((effect.argument - remaining) / PULSE_FRAME_PERIOD)
+				% (2 * PULSE_HALF_PERIOD_FRAMES);
+	}
+
+	// a session may last hours so scale the times down until the product
+	// fits in 32 bits; what is lost is far less than a step of the bar
+	uint32_t duration = effect.duration;
+	while(0xFFFFFFFF / (LED_COUNT * (uint32_t)COUNTDOWN_SUBSTEPS) < duration) {
+		duration >>= 1;
+		remaining >>= 1;
+	}
+	uint16_t length = remaining * LED_COUNT * COUNTDOWN_SUBSTEPS / duration;
+
+	if(length != effect.step || frame != effect.steps) {
+		effect.step = length;
+		effect.steps = frame;
+		render(segment, effect);
+	}
+}
+
+void effects_update() {
+	for(uint8_t i = 0; i < LED_STRIPS; i++) {
+		Segment & segment = segments[i];
+		Effect & effect = segment.stack[segment.top];
+		switch(effect.type) {
+			case EFFECT_WIPE:
+			case EFFECT_BLINK:
+			case EFFECT_FLASH:
+			case EFFECT_ALERT:
+				update_timed_effect(segment, effect);
+				break;
+			case EFFECT_PULSE:
+				update_pulse(segment, effect);
+				break;
+			case EFFECT_HUE:
+				update_hue(segment, effect);
+				break;
+			case EFFECT_CHASE:
+			case EFFECT_COMET:
+			case EFFECT_SPARKLE:
+			case EFFECT_RAINBOW:
+			case EFFECT_THEATER:
+				update_animation(segment, effect);
+				break;
+			case EFFECT_FADE:
+				update_timed_effect(segment, effect);
+				break;
+			case EFFECT_COUNTDOWN:
+				update_countdown(segment, effect);
+				break;
+			case EFFECT_COLOR:
+			case EFFECT_GRADIENT:
+				break;
+		}
+	}
+
+	// every segment rendered this pass goes out in one frame; while
+	// dithering frames go out continually
+#if LED_DITHER
+	dirty |= dithering;
+#endif
+	if(dirty && !held) {
+		show();
+	}
+
+	uint32_t now = clock_millis();
+	if(1000 <= now - frame_rate_start) {
+		frame_rate = frames;
+		frames = 0;
+		frame_rate_start = now;
+	}
+}
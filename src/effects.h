@@ -0,0 +1,319 @@
+/**
+ *	The effects the firmware can display on the strip of LED arrays.
+ *
+ *	Effects do not block. Starting an effect only records what is to be shown
+ *	and `effects_update`, called on every pass through loop, renders whatever
+ *	frame is due. This way serial input is read while an effect runs and a
+ *	new command takes over from the running effect straight away.
+ *
+ *	Each strip is a segment of LED_COUNT LEDs and has effects of its own. In
+ *	each segment effects are kept on a stack. The effect at the bottom is the
+ *	base effect (color, wipe, fade, gradient, pulse, hue, countdown or an
+ *	animation) and starting a new base effect replaces it along with
+ *	everything above.
+ *	Transient effects (blink, flash and alert) are pushed on top of whatever
+ *	is running and when they finish they are popped and the effect below
+ *	carries on from exactly where it was suspended.
+ *
+ *	Every effect has a priority (see PRIORITY_AMBIENT) and the stack is kept
+ *	in priority order, so that the running effect is the one that matters
+ *	most and anything of lower priority waits beneath it.
+ *
+ *	Effects with a duration are given a sequence number when started. When
+ *	one finishes we send the unsolicited event "done <sequence>" over Serial
+ *	and when a new effect takes over before it finishes we send
+ *	"done <sequence> preempted".
+ */
+
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include <stdint.h>
+
+/**
+ * Define the Digital IO pin that is connected to the data line for controlling
+ * the strip of LED Arrays 
+ */
+#define LED_PIN 5
+
+/**
+ * Define how the waveform for the strip is generated; LED_DRIVER_BITBANG or
+ * LED_DRIVER_SPI (see strip.h), which needs LED_PIN to be 11 and a single
+ * strip
+ */
+#define LED_DRIVER LED_DRIVER_BITBANG
+
+/**
+ * Define how many LED arrays are in the strip
+ */
+#define LED_COUNT 15
+
+/**
+ * Define how many strips there are. When more than one they must each be
+ * LED_COUNT long and on consecutive pins of one port starting at LED_PIN; they
+ * are then driven in parallel (see parallel_strip.h) and each is a segment
+ * with effects of its own.
+ */
+#define LED_STRIPS 1
+
+/**
+ * Define whether a frame of the strip is kept in SRAM. When 0 nothing is kept
+ * and each pixel is worked out from the running effect as it is sent (see
+ * procedural_strip.h) so LED_COUNT is not limited by SRAM; this needs a single
+ * strip and the bitbang driver.
+ */
+#define LED_FRAMEBUFFER 1
+
+/**
+ * Define whether a single strip keeps a second frame (see Strip) so that the
+ * frame being sent is never the one effects are rendering into. It costs
+ * another LED_COUNT pixels of SRAM and a copy of the frame on each show.
+ * Several strips, and a strip without a framebuffer, keep a single frame.
+ * Off while frames are sent from loop rather than from an interrupt, as
+ * nothing then renders while a frame is sent.
+ */
+#define LED_DOUBLE_BUFFER 0
+
+/**
+ * Define whether effects are rendered at 16 bits per channel and dithered
+ * down to the 8 the LEDs take over successive frames. Low brightnesses then
+ * fade smoothly rather than in visible steps, at the cost of 16 bits per
+ * channel of SRAM and of the strip being shown continually while an effect
+ * animates through low levels. Still effects are rounded and shown once.
+ * Needs a framebuffer.
+ */
+#define LED_DITHER 1
+
+/**
+ * Define the pixel format of the LED arrays; one of the Format types in
+ * strip.h. FormatGRB for WS2812, FormatGRBW for SK6812 RGBW.
+ */
+#define LED_FORMAT FormatGRB
+
+/**
+ * Set a default brightness to about 1/5 (max = 255)
+ */
+#define DEFAULT_BRIGHTNESS 128
+
+#define MAX_PULSE_BRIGHTNESS 120
+#define MIN_PULSE_BRIGHTNESS 20
+#define PULSE_BRIGHTNESS_STEP 5
+
+/**
+ * Milliseconds between the frames of the pulse effect
+ */
+#define PULSE_FRAME_PERIOD 100
+
+/**
+ * How many effects may be stacked; the base effect and up to three transient
+ * effects over it. Pushing onto a full stack pre-empts the top effect.
+ */
+#define EFFECT_STACK_DEPTH 4
+
+/**
+ * Milliseconds the alert effect spends on and then off for each repeat
+ */
+#define ALERT_PHASE_PERIOD 150
+
+/**
+ * The most color stops a gradient may have
+ */
+#define GRADIENT_MAX_STOPS 5
+
+/**
+ * Effect priorities. A new effect of at least the priority of the running
+ * effect pre-empts it. One of lower priority is either queued behind the
+ * effects that outrank it or dropped depending on the policy. Each effect has
+ * a default priority used when it is started with PRIORITY_DEFAULT.
+ */
+#define PRIORITY_AMBIENT 0		// base effects
+#define PRIORITY_STATUS 1		// blink and flash
+#define PRIORITY_ALERT 2		// alert
+#define PRIORITY_SAFETY 3
+#define PRIORITY_DEFAULT 0xFF
+
+/**
+ * Initialize the strip and show the base effects last saved with
+ * effects_save, or blank it if there are none
+ */
+void effects_begin();
+
+/**
+ * Save the base effect of each segment to EEPROM, if changed, to be shown
+ * again at boot. Transient effects are not saved; a wipe or fade is saved as
+ * the color it ends on and a countdown as the dark segment it leaves.
+ */
+void effects_save();
+
+/**
+ * Select the segment (strip) that effects are subsequently started on or
+ * cancelled from. Returns false if there is no such segment.
+ */
+bool effects_select_segment(uint8_t segment);
+
+/**
+ * Set whether an effect of lower priority than the running effect is queued
+ * (true, the default) or dropped (false).
+ */
+void effects_set_queue_policy(bool queue);
+
+/**
+ * While held, effects carry on being rendered but the strip is not shown;
+ * once released whatever has changed goes out in one frame.
+ */
+void effects_hold(bool hold);
+
+/**
+ * The frames shown in the last whole second and an estimate of the most that
+ * could be shown per second; from the time taken to send the last frame and
+ * let it latch
+ */
+uint16_t effects_frame_rate();
+uint16_t effects_max_frame_rate();
+
+/**
+ * True until the timed effect with the given sequence number has finished;
+ * while it runs or waits beneath another on any segment
+ */
+bool effects_pending(uint16_t sequence);
+
+/**
+ * True when nothing will change on the strip until another command arrives;
+ * every segment shows a still effect and nothing is waiting to be shown
+ */
+bool effects_idle();
+
+/**
+ * End the running effect as though pre-empted. A transient effect gives way
+ * to the effect below; the base effect is replaced with black at
+ * PRIORITY_AMBIENT.
+ */
+void effects_cancel();
+
+/**
+ * The functions that start an effect return false or, for timed effects, a
+ * sequence number of zero when the effect is dropped because one of higher
+ * priority is running.
+ */
+
+/**
+ * Transiently blink the whole strip between black and the color `repeats`
+ * times over `duration` milliseconds. Returns the sequence number of the
+ * effect.
+ */
+uint16_t effects_blink(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t duration, uint16_t repeats, uint8_t priority);
+
+/**
+ * Transiently show the color on the whole strip for `duration` milliseconds.
+ * Returns the sequence number of the effect.
+ */
+uint16_t effects_flash(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t duration, uint8_t priority);
+
+/**
+ * Transiently flash the color on the whole strip `repeats` times, on and off
+ * for ALERT_PHASE_PERIOD milliseconds each. Returns the sequence number of
+ * the effect.
+ */
+uint16_t effects_alert(uint8_t red, uint8_t green, uint8_t blue,
+		uint16_t repeats, uint8_t priority);
+
+/**
+ * Light the strip one LED at a time with the color over `duration`
+ * milliseconds, wiping over the color of the previous base effect. Returns
+ * the sequence number of the effect.
+ */
+uint16_t effects_wipe(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t duration, uint8_t priority);
+
+/**
+ * Set the whole strip to the color. White is only shown by RGBW strips.
+ */
+bool effects_color(uint8_t red, uint8_t green, uint8_t blue, uint8_t white,
+		uint8_t priority);
+
+/**
+ * Rotate the hue of the segment round the color wheel once every period
+ * milliseconds at the given saturation and value. Period must not be 0.
+ */
+bool effects_hue(uint32_t period, uint8_t saturation, uint8_t value,
+		uint8_t priority);
+
+/**
+ * Animations; each is a base effect that runs until replaced and advances a
+ * frame every period milliseconds, which must not be 0. Except for rainbow
+ * they are drawn over the color of the base effect they replaced.
+ *
+ * chase: a block of length LEDs of the color runs along the segment.
+ * comet: as chase but the head is followed by a tail length LEDs long that
+ * fades into the background.
+ * sparkle: each frame a random density / 256 of the LEDs light in the color.
+ * rainbow: the color wheel spread over length LEDs scrolls along the segment.
+ * theater: every spacing-th LED is lit, the lit LEDs stepping along by one.
+ *
+ * Lengths and spacing must be at least 1.
+ */
+bool effects_chase(uint8_t red, uint8_t green, uint8_t blue, uint32_t period,
+		uint16_t length, uint8_t priority);
+bool effects_comet(uint8_t red, uint8_t green, uint8_t blue, uint32_t period,
+		uint16_t length, uint8_t priority);
+bool effects_sparkle(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t period, uint8_t density, uint8_t priority);
+bool effects_rainbow(uint32_t period, uint16_t length, uint8_t priority);
+bool effects_theater(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t period, uint8_t spacing, uint8_t priority);
+
+/**
+ * Show the time left of a duration in milliseconds as a bar of the color that
+ * shrinks from the whole segment to nothing, the LED at its end dimming
+ * smoothly. For the last warning milliseconds the bar turns the warning color
+ * and pulses. Unlike other effects it is not paused while a transient effect
+ * runs over it. Returns the sequence number for its "done" event, sent when
+ * the time is up, or 0 if dropped.
+ */
+uint16_t effects_countdown(uint32_t duration, uint8_t red, uint8_t green,
+		uint8_t blue, uint32_t warning, uint8_t warning_red,
+		uint8_t warning_green, uint8_t warning_blue, uint8_t priority);
+
+/**
+ * Fill LEDs first to last of the segment with a gradient through the colors,
+ * given as red, green and blue, spaced evenly from first to last. There must
+ * be from 2 to GRADIENT_MAX_STOPS colors and at least as many LEDs. The other
+ * LEDs keep the color of the base effect it replaces. Returns false when the
+ * arguments are out of range as well as when dropped; the command checks
+ * them first.
+ */
+bool effects_gradient(uint16_t first, uint16_t last,
+		const uint8_t colors[][3], uint8_t stops, uint8_t priority);
+
+/**
+ * Easing curves for fades; see math8.h
+ */
+#define EASE_LINEAR 0
+#define EASE_IN 1
+#define EASE_OUT 2
+#define EASE_IN_OUT 3
+
+/**
+ * Fade each LED of the segment from what it shows now to the color over
+ * duration milliseconds along the easing curve. Without a framebuffer the
+ * fade is from the color of the effect shown. Returns the sequence number of
+ * the effect.
+ */
+uint16_t effects_fade(uint8_t red, uint8_t green, uint8_t blue,
+		uint32_t duration, uint8_t easing, uint8_t priority);
+
+/**
+ * Pulse the brightness of the color of the base effect, indefinitely
+ */
+bool effects_pulse(uint8_t priority);
+
+/**
+ * Render the frame of the running effect of each segment if one is due and
+ * show the strip if anything changed. Call as often as possible; starting an
+ * effect does not show its first frame, this does.
+ */
+void effects_update();
+
+#endif
@@ -21,42 +21,76 @@
  */
 
 #include <Arduino.h>
-#include <Adafruit_NeoPixel.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include "clock.h"
+#include "color.h"
+#include "effects.h"
+#include "persist.h"
+#include "portal.h"
+#include "strip.h"
+
+/**
+ * The version of this firmware, announced at boot
+ */
+#define FIRMWARE_VERSION "2.0.0"
+
+/**
+ * The commit the firmware was built from; defined by build_hash.py
+ */
+#ifndef FIRMWARE_BUILD
+#define FIRMWARE_BUILD "unknown"
+#endif
+
+/**
+ * The version of the command protocol; bumped whenever commands are added or
+ * what they take or respond with changes
+ */
+#define PROTOCOL_VERSION 2
+
+/**
+ * The bits of the feature bitmap reported by the version command
+ */
+#define FEATURE_FRAMEBUFFER 0x01		// else pixels are shaded as sent
+#define FEATURE_DOUBLE_BUFFER 0x02
+#define FEATURE_DITHER 0x04
+#define FEATURE_SPI 0x08				// the SPI driver rather than bitbang
+#define FEATURE_PARALLEL 0x10			// several strips driven in parallel
+#define FEATURE_RGBW 0x20
 
 /**
  * Define a maximum command buffer length that is actually one shorter than
- * what we intend to be the maximum. This way when we init the buffer with
- * `calloc` and clear it with `memset` there will always be a "null" byte at
- * the end of the buffer making it safe to pass the buffer to the UNSAFE avr
- * string functions like `strtok`
+ * what we intend to be the maximum. This way when we allocate the buffer (zero
+ * filled as a global) and clear it with `memset` there will always be a "null"
+ * byte at the end of the buffer making it safe to pass the buffer to the
+ * UNSAFE avr string functions like `strtok`
  */
 #define MAX_INPUT_BUFFER_LEN 127
 
 /**
- * Define the Digital IO pin that is connected to the data line for controlling
- * the strip of LED Arrays 
+ * Commands prefixed with "@<device_time>" wait in a small queue until the
+ * device clock reaches that time. Define how many may be waiting at once and
+ * how long each may be; kept short as every slot costs SRAM.
  */
-#define LED_PIN 5
+#define SCHEDULE_LENGTH 4
+#define MAX_SCHEDULED_COMMAND_LEN 47
 
 /**
- * Define how many LED arrays are in the strip
+ * Limits on the arguments of timed effects. Durations are in milliseconds.
  */
-#define LED_COUNT 15
+#define MAX_DURATION 32767
+#define MAX_REPEATS 32767
 
 /**
- * Set a default brightness to about 1/5 (max = 255)
+ * The longest countdown, in milliseconds; a day
  */
-#define DEFAULT_BRIGHTNESS 128
-
-#define MAX_PULSE_BRIGHTNESS 120
-#define MIN_PULSE_BRIGHTNESS 20
-#define PULSE_BRIGHTNESS_STEP 5
+#define MAX_COUNTDOWN 86400000L
 
 /*
  * Declare a buffer where we will accumulate characters coming in over the
- * Serial connection
+ * Serial connection; one byte longer than max so always ends in \0 for strtok
  */
-char *input_buffer;
+char input_buffer[MAX_INPUT_BUFFER_LEN + 1];
 
 /**
  * The Arduino `readBytesUntil` function is non blocking. Therefore we must
@@ -67,168 +101,666 @@ char *input_buffer;
 int len_input_buffer_data;
 
 /**
- *	Declare the interface to the strip of LED arrays
+ * The clock_micros at which the command being processed was received; that is
+ * when its terminating new line was read or, for a scheduled command, when it
+ * fell due. Reported by the sync command so the host can estimate the offset
+ * between its clock and ours.
+ */
+uint32_t command_received_at;
+
+/**
+ * A command waiting for the device clock to reach `due` (in clock_millis).
+ * A slot is free when its command is the empty string.
+ */
+struct ScheduledCommand {
+	uint32_t due;
+	char command[MAX_SCHEDULED_COMMAND_LEN + 1];
+};
+
+ScheduledCommand schedule[SCHEDULE_LENGTH];
+
+/**
+ * Time spent asleep in idle mode, in whole milliseconds and the microseconds
+ * over
+ */
+uint32_t asleep_millis = 0;
+uint16_t asleep_fraction = 0;
+
+/**
+ * The clock_micros at which the CPU last woke and, for the last command that
+ * arrived while it slept, the microseconds from waking to the command being
+ * carried out
+ */
+uint32_t woke_at;
+bool just_woke = false;
+uint32_t wake_latency = 0;
+
+/**
+ * The result of a command that has sent its own response
  */
-Adafruit_NeoPixel strip;
+#define ALREADY_RESPONDED -1
 
 /**
- * flag to indicate we should be pulsing.
+ * Whether a transaction is open; begun but not yet committed
  */
-bool is_pulsing = false;
-bool pulse_rising = false;
+bool in_transaction = false;
+
+/**
+ * The response so far to the batch of commands being carried out; see
+ * process_command. Commands are numbered from 1 in the order they are
+ * carried out and batch_failed is the number of the one that failed, 0 while
+ * none has.
+ */
+int batch_errno;
+uint16_t batch_sequence;
+uint16_t batch_commands;
+uint16_t batch_failed;
+
+/**
+ * Place a command in the schedule to be run once clock_millis reaches due.
+ * Returns false if the command is missing or too long or the schedule is full.
+ */
+bool schedule_command(uint32_t due, const char * command) {
+	if(NULL == command || MAX_SCHEDULED_COMMAND_LEN < strlen(command)) {
+		return false;
+	}
+
+	for(int i = 0; i < SCHEDULE_LENGTH; i++) {
+		if(0 == schedule[i].command[0]) {
+			schedule[i].due = due;
+			strcpy(schedule[i].command, command);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * True if a command is waiting in the schedule
+ */
+bool schedule_pending() {
+	for(int i = 0; i < SCHEDULE_LENGTH; i++) {
+		if(0 != schedule[i].command[0]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Parse the next space separated fragment of the command being processed with
+ * `strtok` as an integer. Returns false if there is no such fragment or its
+ * value lies outside [min, max].
+ */
+bool next_argument(long min, long max, long * value) {
+	char * fragment = strtok(NULL, " ");
+	if(NULL == fragment) {
+		return false;
+	}
+
+	*value = atol(fragment);
+	return min <= *value && max >= *value;
+}
 
 /**
- * Parse a command and carry it out.
+ * As next_argument but for an argument that may be left off the end of the
+ * command; then value is set to zero.
  */
-void process_command(char * command) {
+bool next_optional_argument(long min, long max, long * value) {
+	char * fragment = strtok(NULL, " ");
+	*value = (NULL == fragment) ? 0 : atol(fragment);
+	return min <= *value && max >= *value;
+}
+
+/**
+ * Parse the next three fragments of the command being processed as the red,
+ * green and blue components of a color; each an unsigned char.
+ */
+bool next_color(long * red, long * green, long * blue) {
+	return next_argument(0, 255, red) && next_argument(0, 255, green)
+			&& next_argument(0, 255, blue);
+}
+
+/**
+ * Parse an effect priority given either by name or by number
+ */
+int parse_priority(const char * text) {
+	if(0 == strcmp("ambient", text) || 0 == strcmp("0", text)) {
+		return PRIORITY_AMBIENT;
+	} else if(0 == strcmp("status", text) || 0 == strcmp("1", text)) {
+		return PRIORITY_STATUS;
+	} else if(0 == strcmp("alert", text) || 0 == strcmp("2", text)) {
+		return PRIORITY_ALERT;
+	} else if(0 == strcmp("safety", text) || 0 == strcmp("3", text)) {
+		return PRIORITY_SAFETY;
+	}
+	return -1;
+}
+
+/**
+ * Parse the name of an easing curve; linear when there is none. Returns -1
+ * for an unknown curve.
+ */
+int parse_easing(const char * text) {
+	if(NULL == text || 0 == strcmp("linear", text)) {
+		return EASE_LINEAR;
+	} else if(0 == strcmp("in", text)) {
+		return EASE_IN;
+	} else if(0 == strcmp("out", text)) {
+		return EASE_OUT;
+	} else if(0 == strcmp("inout", text)) {
+		return EASE_IN_OUT;
+	}
+	return -1;
+}
+
+/**
+ * The features this firmware was built with, as reported by the version
+ * command. Double buffering only applies to a single framebuffered strip.
+ */
+uint16_t firmware_features() {
+	uint16_t features = 0;
+	if(LED_FRAMEBUFFER) {
+		features |= FEATURE_FRAMEBUFFER;
+	}
+	if(LED_FRAMEBUFFER && LED_DOUBLE_BUFFER && 1 == LED_STRIPS) {
+		features |= FEATURE_DOUBLE_BUFFER;
+	}
+	if(LED_DITHER) {
+		features |= FEATURE_DITHER;
+	}
+	if(LED_DRIVER_SPI == LED_DRIVER) {
+		features |= FEATURE_SPI;
+	}
+	if(1 < LED_STRIPS) {
+		features |= FEATURE_PARALLEL;
+	}
+	if(4 == LED_FORMAT::CHANNELS) {
+		features |= FEATURE_RGBW;
+	}
+	return features;
+}
+
+/**
+ * Parse a single command and carry it out. Returns 0 on success, 1 if the
+ * command was not understood or its arguments were invalid, 2 if it was
+ * dropped because an effect of higher priority is running, or
+ * ALREADY_RESPONDED for commands that respond with data themselves. When a
+ * timed effect is started its sequence number is written to sequence.
+ */
+int execute_command(char * command, uint16_t * sequence) {
 	int errno = 0;
-	digitalWrite(LED_BUILTIN, LOW);
+	uint8_t priority = PRIORITY_DEFAULT;
 
 	// get command part of buffer and determine if it is recognized
 	char * fragment = strtok(command, " ");
-	if(0 == strcmp("blink", fragment)) {
-		// the blink command requires a color as three components, a duration,
-		// and a repeat as inputs
-		fragment = strtok(NULL, " ");
-		int red = atoi(fragment);
-		if(0 > red || 255 < red) {
-			Serial.println(1); // respond that there was an error
-			return;
+	bool prefixed = false;
+	effects_select_segment(0);
+	while(NULL != fragment && ('!' == fragment[0] || '#' == fragment[0])) {
+		// "!<priority> <command>" starts the effect of command at the given
+		// priority rather than its default and "#<segment> <command>" starts
+		// it on the given segment (strip) rather than the first
+		bool valid;
+		if('!' == fragment[0]) {
+			int value = parse_priority(fragment + 1);
+			valid = 0 <= value;
+			priority = value;
+		} else {
+			valid = effects_select_segment(atoi(fragment + 1));
 		}
-
-		fragment = strtok(NULL, " ");
-		int green = atoi(fragment);
-		if(0 > green || 255 < green) {
-			Serial.println(1); // respond that there was an error
-			return;
+		if(!valid) {
+			return 1;
 		}
-
+		prefixed = true;
 		fragment = strtok(NULL, " ");
-		int blue = atoi(fragment);
-		if(0 > blue || 255 < blue) {
-			Serial.println(1); // respond that there was an error
-			return;
-		}
+	}
 
-		fragment = strtok(NULL, " ");
-		int duration = atoi(fragment);
-		if(0 > duration) {
-			Serial.println(1); // respond that there was an error
-			return;
+	if(NULL == fragment) {
+		errno = 1;
+	} else if('@' == fragment[0]) {
+		// "@<device_time> <command>" defers the rest of the line until
+		// clock_millis reaches device_time. We respond now that the command
+		// was queued; the command responds as usual when it runs. Priority
+		// and segment must follow rather than precede the time
+		char * end;
+		uint32_t due = strtoul(fragment + 1, &end, 10);
+		if(!prefixed && fragment + 1 != end && 0 == *end
+				&& schedule_command(due, strtok(NULL, ""))) {
+			errno = 0;
+		} else {
+			errno = 1;
 		}
-
-		fragment = strtok(NULL, " ");
-		int repeats = atoi(fragment);
-		if(0 > repeats) {
-			Serial.println(1); // respond that there was an error
-			return;
+	} else if(0 == strcmp("blink", fragment)) {
+		// the blink command requires a color as three components, a duration,
+		// and a repeat as inputs. It is transient; once done the previous
+		// effect is restored
+		long red, green, blue, duration, repeats;
+		if(next_color(&red, &green, &blue)
+				&& next_argument(0, MAX_DURATION, &duration)
+				&& next_argument(0, MAX_REPEATS, &repeats)) {
+			*sequence = effects_blink(red, green, blue, duration, repeats,
+					priority);
+			errno = (0 == *sequence) ? 2 : 0;
+		} else {
+			errno = 1;
 		}
-
-		int wait = duration / (2 * repeats);
-		uint32_t color = strip.Color(red, green, blue);
-		uint32_t black = strip.Color(0,0,0);
-
-		is_pulsing = false;
-		strip.setBrightness(DEFAULT_BRIGHTNESS);
-		for(int i = 0; i < repeats; i++) {
-			for(int j = 0; j < LED_COUNT; j++) {
-				strip.setPixelColor(j, black);
-			}
-			strip.show();
-			delay(wait);
-			for(int j = 0; j < LED_COUNT; j++) {
-				strip.setPixelColor(j, color);
-			}
-			strip.show();
-			delay(wait);
+	} else if(0 == strcmp("flash", fragment)) {
+		// the flash command requires a color as three components and a
+		// duration. It is transient; once done the previous effect is restored
+		long red, green, blue, duration;
+		if(next_color(&red, &green, &blue)
+				&& next_argument(0, MAX_DURATION, &duration)) {
+			*sequence = effects_flash(red, green, blue, duration,
+					priority);
+			errno = (0 == *sequence) ? 2 : 0;
+		} else {
+			errno = 1;
 		}
-		for(int j = 0; j < LED_COUNT; j++) {
-			strip.setPixelColor(j, black);
+	} else if(0 == strcmp("alert", fragment)) {
+		// the alert command requires a color as three components and a
+		// repeat. It is transient; once done the previous effect is restored
+		long red, green, blue, repeats;
+		if(next_color(&red, &green, &blue)
+				&& next_argument(0, MAX_REPEATS, &repeats)) {
+			*sequence = effects_alert(red, green, blue, repeats,
+					priority);
+			errno = (0 == *sequence) ? 2 : 0;
+		} else {
+			errno = 1;
 		}
-		strip.show();
 	} else if(0 == strcmp("wipe", fragment)) {
 		// the wipe command requires four values: red, green, blue, duration
 		// red, green and blue are unsigned chars. duration is an unsigned int
 		// of milliseconds that the entire effect should take to complete.
-		fragment = strtok(NULL, " ");
-		int red = atoi(fragment);
-		if(0 > red || 255 < red) {
-			Serial.println(1); // respond that there was an error
-			return;
-		}
-
-		fragment = strtok(NULL, " ");
-		int green = atoi(fragment);
-		if(0 > green || 255 < green) {
-			Serial.println(1); // respond that there was an error
-			return;
+		long red, green, blue, duration;
+		if(next_color(&red, &green, &blue)
+				&& next_argument(0, MAX_DURATION, &duration)) {
+			*sequence = effects_wipe(red, green, blue, duration,
+					priority);
+			errno = (0 == *sequence) ? 2 : 0;
+		} else {
+			errno = 1;
 		}
-
-		fragment = strtok(NULL, " ");
-		int blue = atoi(fragment);
-		if(0 > blue || 255 < blue) {
-			Serial.println(1); // respond that there was an error
-			return;
+	} else if(0 == strcmp("fade", fragment)) {
+		// the fade command requires a color as three components and a
+		// duration in milliseconds and may be followed by an easing curve:
+		// linear (the default), in, out or inout
+		long red, green, blue, duration;
+		if(next_color(&red, &green, &blue)
+				&& next_argument(0, MAX_DURATION, &duration)) {
+			fragment = strtok(NULL, " ");
+			int easing = parse_easing(fragment);
+			if(0 <= easing) {
+				*sequence = effects_fade(red, green, blue, duration, easing,
+						priority);
+				errno = (0 == *sequence) ? 2 : 0;
+			} else {
+				errno = 1;
+			}
+		} else {
+			errno = 1;
 		}
-
-		fragment = strtok(NULL, " ");
-		int duration = atoi(fragment);
-		if(0 > duration) {
-			Serial.println(1); // respond that there was an error
-			return;
+	} else if(0 == strcmp("gradient", fragment)) {
+		// the gradient command requires the first and last LED of the
+		// segment to fill followed by between two and GRADIENT_MAX_STOPS
+		// colors, each as three components, spread evenly between them
+		long first, last;
+		uint8_t colors[GRADIENT_MAX_STOPS][3];
+		uint8_t stops = 0;
+		bool valid = next_argument(0, LED_COUNT - 1, &first)
+				&& next_argument(0, LED_COUNT - 1, &last);
+		while(valid && NULL != (fragment = strtok(NULL, " "))) {
+			long red = atol(fragment);
+			long green, blue;
+			valid = GRADIENT_MAX_STOPS > stops && 0 <= red && 255 >= red
+					&& next_argument(0, 255, &green)
+					&& next_argument(0, 255, &blue);
+			if(valid) {
+				colors[stops][0] = red;
+				colors[stops][1] = green;
+				colors[stops][2] = blue;
+				stops++;
+			}
 		}
-
-		uint32_t color = strip.Color(red, green, blue);
-		int wait = duration / LED_COUNT;
-
-		is_pulsing = false;
-		strip.setBrightness(DEFAULT_BRIGHTNESS);
-		for(int i=0; i<LED_COUNT; i++) {
-			strip.setPixelColor(i, color);
-			strip.show();
-			delay(wait);
+		// there must be at least as many LEDs as stops
+		if(valid && 2 <= stops && first + stops - 1 <= last) {
+			errno = effects_gradient(first, last, colors, stops, priority)
+					? 0 : 2;
+		} else {
+			errno = 1;
 		}
 	} else if(0 == strcmp("color", fragment)) {
 		// the color command requires three values: red, green, and blue. Red,
-		// green and blue are unsigned chars.
+		// green and blue are unsigned chars. An optional fourth value, also
+		// an unsigned char, drives the white LED of RGBW arrays.
+		long red, green, blue, white;
+		if(next_color(&red, &green, &blue)
+				&& next_optional_argument(0, 255, &white)) {
+			errno = effects_color(red, green, blue, white, priority) ? 0 : 2;
+		} else {
+			errno = 1;
+		}
+	} else if(0 == strcmp("hsv", fragment)) {
+		// the hsv command sets a color as hue, saturation and value, each an
+		// unsigned char, sparing the host the conversion
+		long hue, saturation, value;
+		if(next_argument(0, 255, &hue) && next_argument(0, 255, &saturation)
+				&& next_argument(0, 255, &value)) {
+			uint32_t color = hsv_color(hue, saturation, value);
+			errno = effects_color(color >> 16, color >> 8, color, 0, priority)
+					? 0 : 2;
+		} else {
+			errno = 1;
+		}
+	} else if(0 == strcmp("hue", fragment)) {
+		// the hue command requires a period in milliseconds, a saturation and
+		// a value. The hue turns round the color wheel once per period until
+		// another base effect is started
+		long period, saturation, value;
+		if(next_argument(1, MAX_DURATION, &period)
+				&& next_argument(0, 255, &saturation)
+				&& next_argument(0, 255, &value)) {
+			errno = effects_hue(period, saturation, value, priority) ? 0 : 2;
+		} else {
+			errno = 1;
+		}
+	} else if(0 == strcmp("chase", fragment)
+			|| 0 == strcmp("comet", fragment)
+			|| 0 == strcmp("sparkle", fragment)
+			|| 0 == strcmp("theater", fragment)) {
+		// the animations require a color as three components, the
+		// milliseconds per frame and a length: of the block for chase, of
+		// the tail for comet, the density out of 255 for sparkle and the
+		// spacing of lit LEDs for theater. They run until replaced
+		long red, green, blue, period, length;
+		long max_length = ('c' == fragment[0]) ? 0xFFFF : 255;
+		if(next_color(&red, &green, &blue)
+				&& next_argument(1, MAX_DURATION, &period)
+				&& next_argument(1, max_length, &length)) {
+			bool started;
+			if(0 == strcmp("chase", fragment)) {
+				started = effects_chase(red, green, blue, period, length,
+						priority);
+			} else if(0 == strcmp("comet", fragment)) {
+				started = effects_comet(red, green, blue, period, length,
+						priority);
+			} else if(0 == strcmp("sparkle", fragment)) {
+				started = effects_sparkle(red, green, blue, period, length,
+						priority);
+			} else {
+				started = effects_theater(red, green, blue, period, length,
+						priority);
+			}
+			errno = started ? 0 : 2;
+		} else {
+			errno = 1;
+		}
+	} else if(0 == strcmp("rainbow", fragment)) {
+		// the rainbow command requires the milliseconds per frame and the
+		// number of LEDs over which the color wheel is spread
+		long period, length;
+		if(next_argument(1, MAX_DURATION, &period)
+				&& next_argument(1, 0xFFFF, &length)) {
+			errno = effects_rainbow(period, length, priority) ? 0 : 2;
+		} else {
+			errno = 1;
+		}
+	} else if(0 == strcmp("countdown", fragment)) {
+		// the countdown command requires a duration in milliseconds and a
+		// color as three components. It may be followed by how many
+		// milliseconds before the end to warn and a color to warn in, all
+		// four or none
+		long duration, red, green, blue;
+		long warning = 0, warning_red = 0, warning_green = 0,
+				warning_blue = 0;
+		bool valid = next_argument(1, MAX_COUNTDOWN, &duration)
+				&& next_color(&red, &green, &blue);
+		if(valid && NULL != (fragment = strtok(NULL, " "))) {
+			warning = atol(fragment);
+			valid = 0 <= warning && duration >= warning
+					&& next_color(&warning_red, &warning_green, &warning_blue);
+		}
+		if(valid) {
+			*sequence = effects_countdown(duration, red, green, blue, warning,
+					warning_red, warning_green, warning_blue, priority);
+			errno = (0 == *sequence) ? 2 : 0;
+		} else {
+			errno = 1;
+		}
+	} else if(0 == strcmp("state", fragment)) {
+		// the state command takes a Portal Box state by name or number and
+		// shows its look. Without one it responds with the current state as
+		// "0 <state>"
 		fragment = strtok(NULL, " ");
-		int red = atoi(fragment);
-		if(0 > red || 255 < red) {
-			Serial.println(1); // respond that there was an error
-			return;
+		if(NULL == fragment) {
+			Serial.print(0);
+			Serial.print(' ');
+			Serial.println(portal_state());
+			return ALREADY_RESPONDED;
 		}
-
+		int state = portal_parse_state(fragment);
+		if(0 > state) {
+			errno = 1;
+		} else {
+			errno = portal_enter(state, priority) ? 0 : 2;
+		}
+	} else if(0 == strcmp("look", fragment)) {
+		// the look command sets the look of a state given by name or number
+		// to an effect, named by its command, a color as three components
+		// and up to two more arguments as that command takes them. Rainbow
+		// still takes a color, which it ignores
+		long red, green, blue, period, length;
 		fragment = strtok(NULL, " ");
-		int green = atoi(fragment);
-		if(0 > green || 255 < green) {
-			Serial.println(1); // respond that there was an error
-			return;
+		int state = (NULL == fragment) ? -1 : portal_parse_state(fragment);
+		char * effect = strtok(NULL, " ");
+		if(0 <= state && NULL != effect && next_color(&red, &green, &blue)
+				&& next_optional_argument(0, MAX_DURATION, &period)
+				&& next_optional_argument(0, 0xFFFF, &length)
+				&& portal_set_look(state, effect, red, green, blue, period,
+						length)) {
+			errno = 0;
+		} else {
+			errno = 1;
 		}
-
+	} else if(0 == strcmp("time", fragment)) {
+		// the time command responds with the device clock as
+		// "0 <micros> <millis>"; millis is the timebase for "@" scheduling
+		uint32_t micros = clock_micros();
+		Serial.print(0);
+		Serial.print(' ');
+		Serial.print(micros);
+		Serial.print(' ');
+		Serial.println(clock_millis());
+		return ALREADY_RESPONDED;
+	} else if(0 == strcmp("fps", fragment)) {
+		// the fps command responds with the frames shown in the last second
+		// and an estimate of how many could be for this strip as
+		// "0 <shown> <achievable>"
+		Serial.print(0);
+		Serial.print(' ');
+		Serial.print(effects_frame_rate());
+		Serial.print(' ');
+		Serial.println(effects_max_frame_rate());
+		return ALREADY_RESPONDED;
+	} else if(0 == strcmp("telemetry", fragment)) {
+		// the telemetry command responds with the milliseconds since boot,
+		// the milliseconds of those spent asleep and the microseconds from
+		// waking for the last command that arrived while asleep to carrying
+		// it out as "0 <uptime> <asleep> <latency>"
+		Serial.print(0);
+		Serial.print(' ');
+		Serial.print(clock_millis());
+		Serial.print(' ');
+		Serial.print(asleep_millis);
+		Serial.print(' ');
+		Serial.println(wake_latency);
+		return ALREADY_RESPONDED;
+	} else if(0 == strcmp("version", fragment)) {
+		// the version command responds with what the device runs so the host
+		// need not flash it again as "0 <version> <build> <protocol>
+		// <led count> <driver> <features>"; the driver is bitbang or spi and
+		// features is a bitmap of FEATURE_ bits
+		Serial.print(0);
+		Serial.print(' ');
+		Serial.print(FIRMWARE_VERSION);
+		Serial.print(' ');
+		Serial.print(FIRMWARE_BUILD);
+		Serial.print(' ');
+		Serial.print(PROTOCOL_VERSION);
+		Serial.print(' ');
+		Serial.print(LED_COUNT);
+		Serial.print(' ');
+		Serial.print(LED_DRIVER_SPI == LED_DRIVER ? "spi" : "bitbang");
+		Serial.print(' ');
+		Serial.println(firmware_features());
+		return ALREADY_RESPONDED;
+	} else if(0 == strcmp("sync", fragment)) {
+		// the sync command takes an optional token which is echoed back with
+		// the clock_micros at which the command was received and at which the
+		// response is sent: "0 <token> <received> <sent>". With the host
+		// taking its own time when sending (t1) and on receipt (t4) the offset
+		// of the device clock is ((received - t1) + (sent - t4)) / 2
+		fragment = strtok(NULL, " ");
+		Serial.print(0);
+		Serial.print(' ');
+		Serial.print(NULL == fragment ? "0" : fragment);
+		Serial.print(' ');
+		Serial.print(command_received_at);
+		Serial.print(' ');
+		Serial.println(clock_micros());
+		return ALREADY_RESPONDED;
+	} else if(0 == strcmp("pulse", fragment)) {
+		// pulsing is indefinate... effects_update does it from loop
+		errno = effects_pulse(priority) ? 0 : 2;
+	} else if(0 == strcmp("cancel", fragment)) {
+		// end the running effect as though pre-empted
+		effects_cancel();
+	} else if(0 == strcmp("policy", fragment)) {
+		// the policy command takes "queue" or "drop" and sets what becomes
+		// of an effect started while one of higher priority is running
 		fragment = strtok(NULL, " ");
-		int blue = atoi(fragment);
-		if(0 > blue || 255 < blue) {
-			Serial.println(1); // respond that there was an error
-			return;
+		if(NULL != fragment && 0 == strcmp("queue", fragment)) {
+			effects_set_queue_policy(true);
+		} else if(NULL != fragment && 0 == strcmp("drop", fragment)) {
+			effects_set_queue_policy(false);
+		} else {
+			errno = 1;
 		}
-
-		uint32_t color = strip.Color(red, green, blue);
-
-		is_pulsing = false;
-		strip.setBrightness(DEFAULT_BRIGHTNESS);
-		for(int i=0; i<LED_COUNT; i++) {
-			strip.setPixelColor(i, color);
+	} else if(0 == strcmp("begin", fragment)) {
+		// begin a transaction; the commands up to commit are carried out
+		// but not shown or answered until then
+		if(in_transaction) {
+			errno = 1;
+		} else {
+			in_transaction = true;
+			effects_hold(true);
+		}
+	} else if(0 == strcmp("commit", fragment)) {
+		// end the transaction; what it changed is shown as one frame and
+		// it is answered as one batch
+		if(in_transaction) {
+			in_transaction = false;
+			effects_hold(false);
+		} else {
+			errno = 1;
 		}
-		strip.show();
-	} else if(0 == strcmp("pulse", fragment)) {
-		// pulsing is indefinate... set a flag and do in loop 
-		is_pulsing = true;
 	} else {
 		errno = 1;
 	}
 
+	return errno;
+}
+
+/**
+ * Parse a line of commands separated by ';' and carry them out as a batch.
+ * Effects started by a batch go out in one frame as the strip is only shown
+ * from loop, and the batch gets one response: 0 followed by the sequence
+ * number of the first timed effect started if any; the others are numbered
+ * on from it. Commands that respond with data still do so each for itself.
+ *
+ * The batch stops at the first command that does not succeed, and what the
+ * commands before it did stands. The response is then the result of that
+ * command, the sequence number of the first timed effect started before it
+ * or 0, and the number of the command counting from 1.
+ *
+ * Within a transaction the batch goes on until commit, across lines, and
+ * its response is given then. After a failure the commands up to commit are
+ * skipped.
+ *
+ * A line scheduled with "@" is scheduled whole and run as a batch when due.
+ */
+void process_command(char * line) {
+	digitalWrite(LED_BUILTIN, LOW);
+	if(!in_transaction) {
+		batch_errno = ALREADY_RESPONDED;
+		batch_sequence = 0;
+		batch_commands = 0;
+		batch_failed = 0;
+	}
+
+	bool scheduling = '@' == line[strspn(line, " ")];
+	char * next = line;
+	while(NULL != next) {
+		char * command = next;
+		next = scheduling ? NULL : strchr(command, ';');
+		if(NULL != next) {
+			*next++ = 0;
+		}
+
+		if(0 != batch_failed) {
+			// only the commit that ends the transaction is still carried out
+			char * name = command + strspn(command, " ");
+			if(!in_transaction || 6 != strcspn(name, " ")
+					|| 0 != strncmp("commit", name, 6)) {
+				continue;
+			}
+		}
+
+		batch_commands++;
+		uint16_t sequence = 0;
+		int errno = execute_command(command, &sequence);
+		if(ALREADY_RESPONDED == errno) {
+			continue;
+		}
+		if(0 == batch_failed) {
+			batch_errno = errno;
+			if(0 != errno) {
+				batch_failed = batch_commands;
+			}
+		}
+		if(0 == batch_sequence) {
+			batch_sequence = sequence;
+		}
+	}
+
 	digitalWrite(LED_BUILTIN, HIGH);
-	Serial.println(errno);
+	if(in_transaction) {
+		return;
+	}
+	// what was committed is shown again after a reset
+	effects_save();
+	if(ALREADY_RESPONDED == batch_errno) {
+		return;
+	}
+	if(0 != batch_failed) {
+		// the effects started before the failure still report "done" so the
+		// host needs their sequence numbers too
+		Serial.print(batch_errno);
+		Serial.print(' ');
+		Serial.print(batch_sequence);
+		Serial.print(' ');
+		Serial.println(batch_failed);
+	} else if(0 != batch_sequence) {
+		// a timed effect was accepted; respond with the sequence number that
+		// will be reported by its "done" event
+		Serial.print(batch_errno);
+		Serial.print(' ');
+		Serial.println(batch_sequence);
+	} else {
+		Serial.println(batch_errno);
+	}
 }
 
 /**
@@ -240,34 +772,107 @@ void flush_input_buffer() {
 	len_input_buffer_data = 0;
 }
 
+/**
+ * Run the earliest scheduled command that has fallen due, if any. Only one is
+ * run per call so that serial input is still read between commands that fall
+ * due together.
+ */
+void run_scheduled_command() {
+	int next = -1;
+	for(int i = 0; i < SCHEDULE_LENGTH; i++) {
+		if(0 != schedule[i].command[0] && clock_reached(schedule[i].due)
+				&& (0 > next || 0 > (int32_t)(schedule[i].due - schedule[next].due))) {
+			next = i;
+		}
+	}
+
+	if(0 <= next) {
+		// free the slot before running as the command may itself schedule
+		char command[MAX_SCHEDULED_COMMAND_LEN + 1];
+		strcpy(command, schedule[next].command);
+		schedule[next].command[0] = 0;
+
+		command_received_at = clock_micros();
+		process_command(command);
+	}
+}
+
+/**
+ * Idle the CPU until an interrupt; a byte received, a timer overflow or the
+ * like. In idle mode the peripherals run on so nothing is missed and the CPU
+ * is back within a few cycles. Serial input is checked with interrupts off
+ * and they are only enabled by the instruction before sleep, which always
+ * runs first, so a byte can not arrive unnoticed in between.
+ */
+void sleep_until_interrupt() {
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	cli();
+	if(Serial.available()) {
+		sei();
+		return;
+	}
+
+	uint32_t slept_at = clock_micros();
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+
+	woke_at = clock_micros();
+	just_woke = true;
+	uint32_t asleep = asleep_fraction + (woke_at - slept_at);
+	asleep_millis += asleep / 1000;
+	asleep_fraction = asleep % 1000;
+}
+
+/**
+ * Name the cause of a reset from the flags of the MCU status register. A
+ * power-on reset may set the brown-out flag too. A bootloader that clears
+ * the flags leaves the cause unknown.
+ */
+const char * reset_cause(uint8_t status) {
+	if(status & _BV(PORF)) {
+		return "power-on";
+	} else if(status & _BV(BORF)) {
+		return "brown-out";
+	} else if(status & _BV(WDRF)) {
+		return "watchdog";
+	} else if(status & _BV(EXTRF)) {
+		return "external";
+	}
+	return "unknown";
+}
+
 /**
  *	setup is a special function defined by the Arduino platform
  *	that is called once after the core firmware initialization
  *	happens but before loop is called for the first time
  */
 void setup(void) {
-	// Initialize the input buffer;
-	//   one byte longer than max so always ends in \0 for strtok
-	// Note: can not flush buffer as it does not yet exist
-	input_buffer = (char *)calloc(MAX_INPUT_BUFFER_LEN + 1, 1);
-
-	strip = Adafruit_NeoPixel(LED_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800);
-	strip.begin();
-	strip.setBrightness(DEFAULT_BRIGHTNESS);
-	strip.setBrightness(DEFAULT_BRIGHTNESS);
-	for(int i = 0; i < LED_COUNT; i++) {
-		strip.setPixelColor(i, 0);
-	}
-	strip.show();
+	// the reset flags stay set until cleared so clear them for the next
+	// reset; a watchdog reset leaves the watchdog running
+	uint8_t reset_status = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+
+	// effects are timed against Timer1 rather than millis() as the latter
+	// loses time while the strip is being written
+	clock_begin();
+
+	// the strip shows the effects last committed straight away rather than
+	// waiting for the host to send them again
+	effects_begin();
 
 	pinMode(LED_BUILTIN, OUTPUT);
 	digitalWrite(LED_BUILTIN, HIGH);
 
-	// Initialize serial connection
-	while(!Serial) {
-		delay(100);
-	}
+	// Initialize serial connection and announce the boot as
+	// "boot <version> <reset cause>"
 	Serial.begin(9600);
+	Serial.print("boot ");
+	Serial.print(FIRMWARE_VERSION);
+	Serial.print(' ');
+	Serial.println(reset_cause(reset_status));
 }
 
 /**
@@ -290,6 +895,10 @@ void loop(void) {
 						// so CR+LF does not result in response of:
 						// "invalid command"
 					if(0 < len_input_buffer_data) {
+						command_received_at = clock_micros();
+						if(just_woke) {
+							wake_latency = command_received_at - woke_at;
+						}
 						process_command(input_buffer);
 						flush_input_buffer();
 					}
@@ -307,23 +916,19 @@ void loop(void) {
 		}
 	}
 
-	if(is_pulsing) {
-		int brightness = strip.getBrightness();
-		if(pulse_rising) {
-			brightness += PULSE_BRIGHTNESS_STEP;
-			if(MAX_PULSE_BRIGHTNESS < brightness) {
-				pulse_rising = false;
-				brightness = MAX_PULSE_BRIGHTNESS;
-			}
-		} else {
-			brightness -= PULSE_BRIGHTNESS_STEP;
-			if(MIN_PULSE_BRIGHTNESS > brightness) {
-				pulse_rising = true;
-				brightness = MIN_PULSE_BRIGHTNESS;
-			}
-		}
-		strip.setBrightness(brightness);
-		strip.show();
-		delay(100);
+	// scheduled commands wait for a transaction to be committed lest they
+	// be answered with it
+	if(!in_transaction) {
+		run_scheduled_command();
+	}
+
+	effects_update();
+	persist_update();
+
+	just_woke = false;
+	// asleep only Timer0 wakes us, every 2ms, too late to run a scheduled
+	// command on time
+	if(effects_idle() && !in_transaction && !schedule_pending()) {
+		sleep_until_interrupt();
 	}
 }
@@ -0,0 +1,86 @@
+/**
+ *	Eight bit fixed point arithmetic for effects.
+ *
+ *	A fraction is a uint8_t read as fraction / 256, with 255 taken as one so
+ *	that scaling by it leaves a value unchanged. Every function here is a
+ *	handful of instructions on the AVR: the 8 x 8 bit hardware multiply gives
+ *	a 16 bit product whose high byte is the scaled result, so nothing divides
+ *	and nothing pulls in the float library. Those that need no table are
+ *	constexpr so that they fold away when their arguments are constant.
+ *
+ *	@target Arduino Pro Mini (pro8MHzatmega328)
+ */
+
+#ifndef MATH8_H
+#define MATH8_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+/**
+ * value scaled by fraction; the high byte of value * (fraction + 1)
+ */
+constexpr uint8_t scale8(uint8_t value, uint8_t fraction) {
+	return ((uint16_t)value * (fraction + 1)) >> 8;
+}
+
+/**
+ * The value fraction of the way from a to b; a at 0 and b at 255
+ */
+constexpr uint8_t lerp8(uint8_t a, uint8_t b, uint8_t fraction) {
+	return (a <= b) ? a + scale8(b - a, fraction) : a - scale8(a - b, fraction);
+}
+
+/**
+ * A triangle wave over a period of 256; 0 at 0 rising to 254 at 127 and
+ * falling back again
+ */
+constexpr uint8_t triwave8(uint8_t x) {
+	return ((x & 0x80) ? 255 - x : x) << 1;
+}
+
+/**
+ * Easing curves mapping 0-255 onto 0-255. Quadratic in speeds up from 0,
+ * quadratic out slows down into 255, and cubic in-out (smoothstep) does both.
+ */
+constexpr uint8_t ease8_in_quad(uint8_t x) {
+	return scale8(x, x);
+}
+
+constexpr uint8_t ease8_out_quad(uint8_t x) {
+	return 255 - scale8(255 - x, 255 - x);
+}
+
+constexpr uint8_t ease8_in_out_cubic(uint8_t x) {
+	// x^2 (3 - 2x) with x as x / 256, from the whole 16 bit square so that
+	// rounding between the terms can not make the curve step back
+	return ((uint32_t)((uint16_t)x * x) * (768 - 2 * x)) >> 16;
+}
+
+/**
+ * A quarter of a sine wave, sin(i * 2pi / 256) * 127 for i from 0 to 64
+ */
+static const uint8_t MATH8_QUARTER_SINE[65] PROGMEM = {
+	0, 3, 6, 9, 12, 16, 19, 22, 25, 28, 31, 34, 37, 40, 43, 46,
+	49, 51, 54, 57, 60, 63, 65, 68, 71, 73, 76, 78, 81, 83, 85, 88,
+	90, 92, 94, 96, 98, 100, 102, 104, 106, 107, 109, 111, 112, 113, 115, 116,
+	117, 118, 120, 121, 122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127,
+	127
+};
+
+/**
+ * A sine wave over a period of 256 centred on 128; from 1 to 255. The other
+ * three quarters are reflections of the one in the table.
+ */
+inline uint8_t sin8(uint8_t theta) {
+	uint8_t i = theta & 0x3F;
+	uint8_t magnitude = pgm_read_byte(&MATH8_QUARTER_SINE[
+			(theta & 0x40) ? 64 - i : i]);
+	return (theta & 0x80) ? 128 - magnitude : 128 + magnitude;
+}
+
+inline uint8_t cos8(uint8_t theta) {
+	return sin8(theta + 64);
+}
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ *	Several strips of NeoPixel (WS2812) LED arrays of the same length driven
+ *	at once, one per pin of a single port.
+ *
+ *	Sending strips one after another takes as many times as long as sending
+ *	one. Instead the data lines share a port and every bit goes out on all of
+ *	them at once: the port is written high for all lines, then with the bit of
+ *	each strip so the lines sending a 0 fall, then low so the lines sending a 1
+ *	fall. A frame therefore takes the time of a single strip however many
+ *	strips there are.
+ *
+ *	To leave the bit loop nothing to do but write the port the frame is kept
+ *	transposed: for each byte of each pixel there are eight bytes, one per bit
+ *	from the most significant, each holding that bit of every strip in the
+ *	position of the strip's pin in the port. Its size depends only on the
+ *	length of the strips so strips up to the width of the port come for free.
+ *
+ *	Pixels are addressed as though the strips were joined end to end: pixel n
+ *	is LED n % Count of strip n / Count.
+ *
+ *	On the 328 PORTD pins 0 and 1 are the serial line so at most six strips,
+ *	on pins 2-7, 8-13 or A0-A5, can be driven.
+ *
+ *	Only the bitbang driver is supported as the SPI peripheral has a single
+ *	data line.
+ *
+ *	@target Arduino Pro Mini (pro8MHzatmega328)
+ */
+
+#ifndef PARALLEL_STRIP_H
+#define PARALLEL_STRIP_H
+
+#include <Arduino.h>
+
+#include "clock.h"
+#include "strip.h"
+
+#if LED_DRIVER != LED_DRIVER_BITBANG
+#error "Parallel strips need the bitbang driver"
+#endif
+
+template<uint16_t Count, uint8_t Strips, uint8_t FirstPin, typename Format>
+class ParallelStrip {
+	static_assert((FirstPin < 8) ? (2 <= FirstPin && FirstPin + Strips <= 8)
+			: (FirstPin < 14) ? (FirstPin + Strips <= 14)
+			: (FirstPin + Strips <= 20),
+			"the strips must be on consecutive pins of one port, not the serial pins");
+
+public:
+	/**
+	 * The IO address of the port the data pins are on and their bits in it
+	 */
+	enum : uint8_t {
+		PORT_IO = (FirstPin < 8) ? 0x0B : (FirstPin < 14) ? 0x05 : 0x08,
+		FIRST_BIT = (FirstPin < 8) ? FirstPin
+				: (FirstPin < 14) ? FirstPin - 8 : FirstPin - 14,
+		PINS_MASK = ((1 << Strips) - 1) << FIRST_BIT
+	};
+
+	/**
+	 * Make the data pins outputs
+	 */
+	void begin() {
+		for(uint8_t i = 0; i < Strips; i++) {
+			pinMode(FirstPin + i, OUTPUT);
+			digitalWrite(FirstPin + i, LOW);
+		}
+	}
+
+	/**
+	 * Pack a color as 0xWWRRGGBB. White is ignored by formats without it.
+	 */
+	static uint32_t Color(uint8_t red, uint8_t green, uint8_t blue,
+			uint8_t white = 0) {
+		return ((uint32_t)white << 24) | ((uint32_t)red << 16)
+				| ((uint16_t)green << 8) | blue;
+	}
+
+	void setBrightness(uint8_t value) {
+		brightness = value;
+	}
+
+	uint8_t getBrightness() const {
+		return brightness;
+	}
+
+	/**
+	 * Write a color packed as 0xWWRRGGBB to the n-th pixel, scaled by the
+	 * brightness
+	 */
+	void setPixelColor(uint16_t n, uint32_t color) {
+		uint8_t strip = n / Count;
+		if(strip < Strips) {
+			uint8_t mask = 1 << (FIRST_BIT + strip);
+			uint8_t * bits = &frame[(n % Count) * Format::CHANNELS * 8];
+			set_bits(&bits[Format::RED * 8], scale8(color >> 16, brightness),
+					mask);
+			set_bits(&bits[Format::GREEN * 8], scale8(color >> 8, brightness),
+					mask);
+			set_bits(&bits[Format::BLUE * 8], scale8(color, brightness), mask);
+			if(4 == Format::CHANNELS) {
+				set_bits(&bits[Format::WHITE * 8],
+						scale8(color >> 24, brightness), mask);
+			}
+		}
+	}
+
+	uint16_t numPixels() const {
+		return Count * Strips;
+	}
+
+	/**
+	 * Send the pixels to the strips. Interrupts are disabled while each
+	 * pixel is sent but enabled, if they were to begin with, between pixels.
+	 */
+	void show();
+
+private:
+	/**
+	 * Spread the bits of value over eight bytes of the frame, from the most
+	 * significant, at the strip's mask
+	 */
+	static void set_bits(uint8_t * bits, uint8_t value, uint8_t mask) {
+		for(uint8_t i = 0; i < 8; i++) {
+			if(value & 0x80) {
+				bits[i] |= mask;
+			} else {
+				bits[i] &= ~mask;
+			}
+			value <<= 1;
+		}
+	}
+
+	bool send(bool allow_interrupts);
+
+	// one spare byte as the bit loop loads a byte ahead
+	uint8_t frame[Count * Format::CHANNELS * 8 + 1];
+	uint8_t brightness = 255;
+	uint32_t last_show = 0;
+};
+
+template<uint16_t Count, uint8_t Strips, uint8_t FirstPin, typename Format>
+void ParallelStrip<Count, Strips, FirstPin, Format>::show() {
+	bool interrupts_enabled = SREG & _BV(SREG_I);
+	for(uint8_t attempt = 1; ; attempt++) {
+		while(clock_micros() - last_show < STRIP_LATCH_MICROS) {
+			// let the previous frame latch
+		}
+
+		bool sent = send(interrupts_enabled && attempt < STRIP_SHOW_ATTEMPTS);
+		last_show = clock_micros();
+		if(sent) {
+			break;
+		}
+	}
+}
+
+/**
+ * Send the frame, returning false if it had to be abandoned because an
+ * interrupt between pixels held the data lines low too long.
+ */
+template<uint16_t Count, uint8_t Strips, uint8_t FirstPin, typename Format>
+bool ParallelStrip<Count, Strips, FirstPin, Format>::send(
+		bool allow_interrupts) {
+	uint8_t sreg = SREG;
+	cli();
+
+	for(uint16_t i = 0; i < Count; i++) {
+		const uint8_t * bits = &frame[i * Format::CHANNELS * 8];
+		uint8_t bytes = Format::CHANNELS;
+		uint8_t high = _SFR_IO8(PORT_IO) | PINS_MASK;
+		uint8_t low = _SFR_IO8(PORT_IO) & ~PINS_MASK;
+		uint8_t value;
+		// At 8MHz a cycle is 125ns. Every bit starts with all the lines going
+		// high; those sending a 0 fall after 3 cycles (375ns) and those
+		// sending a 1 after 7 (875ns). A bit takes 10 cycles (1.25us) but the
+		// last of each byte, which also counts the bytes, takes 11. The next
+		// bit is loaded while the lines sending a 1 are high.
+		asm volatile(
+			"ld		%[value], %a[bits]+	\n\t"
+			"1:							\n\t"
+			".rept 7					\n\t"
+			"out	%[port], %[high]	\n\t"	// 0		rising edge
+			"or		%[value], %[low]	\n\t"	// 1
+			"nop						\n\t"	// 2
+			"out	%[port], %[value]	\n\t"	// 3		falling edge of 0s
+			"ld		%[value], %a[bits]+	\n\t"	// 4, 5
+			"nop						\n\t"	// 6
+			"out	%[port], %[low]		\n\t"	// 7		falling edge of 1s
+			"nop						\n\t"	// 8
+			"nop						\n\t"	// 9
+			".endr						\n\t"
+			"out	%[port], %[high]	\n\t"	// 0		rising edge
+			"or		%[value], %[low]	\n\t"	// 1
+			"nop						\n\t"	// 2
+			"out	%[port], %[value]	\n\t"	// 3		falling edge of 0s
+			"ld		%[value], %a[bits]+	\n\t"	// 4, 5
+			"nop						\n\t"	// 6
+			"out	%[port], %[low]		\n\t"	// 7		falling edge of 1s
+			"dec	%[bytes]			\n\t"	// 8
+			"brne	1b					\n\t"	// 9, 10
+			: [value] "=&r" (value), [bits] "+e" (bits), [bytes] "+r" (bytes)
+			: [port] "I" (PORT_IO), [high] "r" (high), [low] "r" (low)
+		);
+
+		if(allow_interrupts && i + 1 < Count) {
+			// as for Strip; Timer1 runs free at 1us per tick
+			uint16_t gap_start = TCNT1;
+			sei();
+			asm volatile("nop");
+			cli();
+			if(STRIP_MAX_GAP_MICROS < (uint16_t)(TCNT1 - gap_start)) {
+				SREG = sreg;
+				return false;
+			}
+		}
+	}
+
+	SREG = sreg;
+	return true;
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "persist.h"
+
+/**
+ * The sequence numbers of slots are compared by their signed 8 bit
+ * difference, which holds only while every slot is less than 128 saves from
+ * the newest
+ */
+#define PERSIST_MAX_SLOTS 128
+
+/**
+ * What follows the record in each slot: its sequence number and the CRC,
+ * low byte first
+ */
+#define PERSIST_TRAILER 3
+
+static uint8_t slots = 0;
+
+/**
+ * The slot of the newest intact record and its sequence number
+ */
+static uint8_t newest;
+static uint8_t newest_sequence;
+
+/**
+ * The record being written, NULL when there is none, the address of the slot
+ * it is written to, the bytes of it written so far and its trailer
+ */
+static const uint8_t * record = NULL;
+static uint16_t record_size;
+static uint16_t target;
+static uint16_t written;
+static uint8_t trailer[PERSIST_TRAILER];
+
+/**
+ * The CRC of the slot at address; of its record and sequence number
+ */
+static uint16_t slot_crc(uint16_t address, uint16_t size) {
+	uint16_t crc = 0xFFFF;
+	for(uint16_t i = 0; i <= size; i++) {
+		crc = _crc_ccitt_update(crc,
+				eeprom_read_byte((const uint8_t *)(uintptr_t)(address + i)));
+	}
+	return crc;
+}
+
+bool persist_load(void * data, uint16_t size) {
+	uint16_t slot_size = size + PERSIST_TRAILER;
+	uint16_t count = (E2END + 1) / slot_size;
+	slots = (PERSIST_MAX_SLOTS < count) ? PERSIST_MAX_SLOTS : count;
+
+	bool found = false;
+	for(uint8_t i = 0; i < slots; i++) {
+		uint16_t address = i * slot_size;
+		const uint8_t * end = (const uint8_t *)(uintptr_t)(address + size);
+		uint8_t sequence = eeprom_read_byte(end);
+		uint16_t crc = eeprom_read_byte(end + 1)
+				| (uint16_t)eeprom_read_byte(end + 2) << 8;
+		if(crc == slot_crc(address, size)
+				&& (!found || 0 < (int8_t)(sequence - newest_sequence))) {
+			found = true;
+			newest = i;
+			newest_sequence = sequence;
+		}
+	}
+
+	if(!found) {
+		// the first save goes to the first slot
+		newest = slots - 1;
+		newest_sequence = 0xFF;
+		return false;
+	}
+
+	eeprom_read_block(data, (const void *)(uintptr_t)(newest * slot_size),
+			size);
+	return true;
+}
+
+void persist_save(const void * data, uint16_t size) {
+	if(NULL == record) {
+		// a save over one not yet finished goes to the same slot
+		target = (uint8_t)((newest + 1) % slots) * (size + PERSIST_TRAILER);
+		trailer[0] = newest_sequence + 1;
+	}
+
+	record = (const uint8_t *)data;
+	record_size = size;
+	written = 0;
+
+	uint16_t crc = 0xFFFF;
+	for(uint16_t i = 0; i < size; i++) {
+		crc = _crc_ccitt_update(crc, record[i]);
+	}
+	crc = _crc_ccitt_update(crc, trailer[0]);
+	trailer[1] = crc;
+	trailer[2] = crc >> 8;
+}
+
+void persist_update() {
+	// the trailer goes last so the slot is not intact until all is written
+	while(NULL != record && eeprom_is_ready()) {
+		uint8_t value = (written < record_size)
+				? record[written] : trailer[written - record_size];
+		uint8_t * address = (uint8_t *)(uintptr_t)(target + written);
+		if(eeprom_read_byte(address) != value) {
+			eeprom_write_byte(address, value);
+		}
+
+		written++;
+		if(record_size + PERSIST_TRAILER == written) {
+			newest = target / (record_size + PERSIST_TRAILER);
+			newest_sequence = trailer[0];
+			record = NULL;
+		}
+	}
+}
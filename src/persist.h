@@ -0,0 +1,42 @@
+/**
+ *	A record kept in EEPROM across resets, written without holding up the
+ *	strip.
+ *
+ *	The EEPROM is divided into as many slots as the record fits and each save
+ *	goes to the slot after the newest, so the cells wear evenly; with a record
+ *	of a few dozen bytes each is written once in every twenty or so saves.
+ *	A slot holds the record, a sequence number one on from the slot before and
+ *	a CRC over both. The newest intact slot is the one with the highest
+ *	sequence number whose CRC matches, so a save cut short by a reset leaves
+ *	the one before in place.
+ *
+ *	Writing a byte of EEPROM takes 3.3ms. Rather than wait, persist_update is
+ *	called from loop and starts the next byte only once the one before is
+ *	done; bytes that already hold their value are skipped.
+ *
+ *	The record must be the same size in every call.
+ */
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <stdint.h>
+
+/**
+ * Read the newest intact record into data. Returns false, leaving data as it
+ * was, if there is none. Must be called once at boot before any save.
+ */
+bool persist_load(void * data, uint16_t size);
+
+/**
+ * Start writing data as the newest record. Data is read as it is written so
+ * it must only change by being saved again, which starts the write over.
+ */
+void persist_save(const void * data, uint16_t size);
+
+/**
+ * Carry on writing the record being saved, if any. Call from loop.
+ */
+void persist_update();
+
+#endif
@@ -0,0 +1,178 @@
+#include <Arduino.h>
+
+#include "effects.h"
+#include "portal.h"
+
+/**
+ * The effects a look can be made of, in the order of LOOK_NAMES
+ */
+enum LookEffect : uint8_t {
+	LOOK_COLOR,
+	LOOK_PULSE,
+	LOOK_BLINK,
+	LOOK_FLASH,
+	LOOK_CHASE,
+	LOOK_COMET,
+	LOOK_SPARKLE,
+	LOOK_RAINBOW,
+	LOOK_THEATER,
+	LOOK_EFFECTS
+};
+
+/**
+ * The commands that start each of the look effects
+ */
+static const char * const LOOK_NAMES[LOOK_EFFECTS] = {
+	"color", "pulse", "blink", "flash", "chase", "comet", "sparkle", "rainbow",
+	"theater"
+};
+
+/**
+ * The names of the states, in order
+ */
+static const char * const STATE_NAMES[PORTAL_STATES] = {
+	"idle", "awaiting-card", "authorized", "grace", "denied", "out-of-service"
+};
+
+/**
+ * An effect and the arguments to start it with
+ */
+struct Look {
+	LookEffect effect;
+	uint8_t red;
+	uint8_t green;
+	uint8_t blue;
+	uint16_t period;
+	uint16_t length;
+};
+
+/**
+ * The look of each state, indexed by state
+ */
+static Look looks[PORTAL_STATES] = {
+	{LOOK_PULSE, 0, 0, 255, 0, 0},				// idle
+	{LOOK_CHASE, 0, 0, 255, 80, 3},				// awaiting card
+	{LOOK_COLOR, 0, 255, 0, 0, 0},				// authorized
+	{LOOK_PULSE, 255, 160, 0, 0, 0},			// grace
+	{LOOK_FLASH, 255, 0, 0, 2000, 0},			// denied
+	{LOOK_COLOR, 255, 0, 0, 0, 0}				// out of service
+};
+
+/**
+ * The state last entered. While the transient look of a state (blink or
+ * flash) is shown, the sequence number of its effect and the state whose
+ * look shows again once it is over.
+ */
+static uint8_t current_state = PORTAL_IDLE;
+static uint16_t transient = 0;
+static uint8_t underlying_state = PORTAL_IDLE;
+
+int portal_parse_state(const char * text) {
+	for(uint8_t i = 0; i < PORTAL_STATES; i++) {
+		if(0 == strcmp(STATE_NAMES[i], text)) {
+			return i;
+		}
+	}
+
+	char * end;
+	long state = strtol(text, &end, 10);
+	if(text == end || 0 != *end || 0 > state || PORTAL_STATES <= state) {
+		return -1;
+	}
+	return state;
+}
+
+bool portal_enter(uint8_t state, uint8_t priority) {
+	const Look & look = looks[state];
+	uint8_t r = look.red;
+	uint8_t g = look.green;
+	uint8_t b = look.blue;
+
+	bool entered;
+	uint16_t sequence = 0;
+	switch(look.effect) {
+		case LOOK_COLOR:
+			entered = effects_color(r, g, b, 0, priority);
+			break;
+		case LOOK_PULSE:
+			entered = effects_color(r, g, b, 0, priority)
+					&& effects_pulse(priority);
+			break;
+		case LOOK_BLINK:
+			sequence = effects_blink(r, g, b, look.period, look.length,
+					priority);
+			entered = 0 != sequence;
+			break;
+		case LOOK_FLASH:
+			sequence = effects_flash(r, g, b, look.period, priority);
+			entered = 0 != sequence;
+			break;
+		case LOOK_CHASE:
+			entered = effects_chase(r, g, b, look.period, look.length,
+					priority);
+			break;
+		case LOOK_COMET:
+			entered = effects_comet(r, g, b, look.period, look.length,
+					priority);
+			break;
+		case LOOK_SPARKLE:
+			entered = effects_sparkle(r, g, b, look.period, look.length,
+					priority);
+			break;
+		case LOOK_RAINBOW:
+			entered = effects_rainbow(look.period, look.length, priority);
+			break;
+		default:
+			entered = effects_theater(r, g, b, look.period, look.length,
+					priority);
+			break;
+	}
+	if(!entered) {
+		return false;
+	}
+
+	// a transient look entered over another returns to the state that one
+	// returns to
+	uint8_t previous = portal_state();
+	if(0 != sequence && 0 == transient) {
+		underlying_state = previous;
+	}
+	transient = sequence;
+	current_state = state;
+	return true;
+}
+
+uint8_t portal_state() {
+	if(0 != transient && !effects_pending(transient)) {
+		current_state = underlying_state;
+		transient = 0;
+	}
+	return current_state;
+}
+
+bool portal_set_look(uint8_t state, const char * effect, uint8_t red,
+		uint8_t green, uint8_t blue, uint16_t period, uint16_t length) {
+	uint8_t i;
+	for(i = 0; i < LOOK_EFFECTS && 0 != strcmp(LOOK_NAMES[i], effect); i++) {
+	}
+	if(PORTAL_STATES <= state || LOOK_EFFECTS == i) {
+		return false;
+	}
+
+	// the animations must advance and have something to draw; twice the
+	// repeats of a blink must fit its step count
+	if((LOOK_CHASE <= i && (0 == period || 0 == length
+			|| ((LOOK_SPARKLE == i || LOOK_THEATER == i) && 255 < length)))
+			|| (LOOK_BLINK == i && 0x7FFF < length)) {
+		return false;
+	}
+
+	Look & look = looks[state];
+	look.effect = (LookEffect)i;
+	look.red = red;
+	look.green = green;
+	look.blue = blue;
+	look.period = period;
+	look.length = length;
+	return true;
+}
@@ -0,0 +1,57 @@
+/**
+ *	The states of a Portal Box and how each looks on the strip.
+ *
+ *	Rather than the Pi sending the commands that make up the look of each
+ *	state on every transition, the looks live here in a table, one entry per
+ *	state, and the Pi just names the state to enter. Each look is one of the
+ *	effects of effects.h with its color and parameters. The table starts out
+ *	with the looks our boxes have always had but any entry may be replaced at
+ *	run time.
+ */
+
+#ifndef PORTAL_H
+#define PORTAL_H
+
+#include <stdint.h>
+
+/**
+ * The states of a Portal Box
+ */
+#define PORTAL_IDLE 0				// waiting for a user
+#define PORTAL_AWAITING_CARD 1		// the user must present a card
+#define PORTAL_AUTHORIZED 2			// the equipment is powered for the user
+#define PORTAL_GRACE 3				// the card was removed; time to put it back
+#define PORTAL_DENIED 4				// the card was refused
+#define PORTAL_OUT_OF_SERVICE 5
+#define PORTAL_STATES 6
+
+/**
+ * Parse a state given either by name or by number. Returns -1 if there is no
+ * such state.
+ */
+int portal_parse_state(const char * text);
+
+/**
+ * Enter a state, starting its look at the given priority on the selected
+ * segment. Returns false, and the state is not entered, if the look was
+ * dropped because an effect of higher priority is running.
+ */
+bool portal_enter(uint8_t state, uint8_t priority);
+
+/**
+ * The state last entered. A state whose look is transient, a blink or flash,
+ * is left once the look is over for the state whose look shows again.
+ */
+uint8_t portal_state();
+
+/**
+ * Replace the look of a state. Effect is the name of the command that starts
+ * it: color, pulse, blink, flash, chase, comet, sparkle, rainbow or theater.
+ * Period and length are the arguments those commands take after the color,
+ * in order; for blink the duration and repeats. Returns false if the effect
+ * is not one of these or its arguments are out of range.
+ */
+bool portal_set_look(uint8_t state, const char * effect, uint8_t red,
+		uint8_t green, uint8_t blue, uint16_t period, uint16_t length);
+
+#endif
@@ -0,0 +1,139 @@
+/**
+ *	A strip of NeoPixel (WS2812) LED arrays that keeps no frame. Instead of
+ *	pixels being written ahead of time, show() is handed a shader, something
+ *	callable as `uint32_t shader(uint16_t n)` giving the color of the n-th
+ *	pixel packed as 0xWWRRGGBB, and calls it for each pixel in turn while the
+ *	data line sits low after the pixel before.
+ *
+ *	A stored frame costs three or four bytes of SRAM per LED so on a 2KB part
+ *	a few hundred LEDs is the limit; here memory does not grow with the length
+ *	of the strip at all. The price is that every pixel must be worked out in
+ *	the gap between pixels: the shader and any interrupts together have to
+ *	fit in STRIP_MAX_GAP_MICROS, some 300 cycles. Effects shown this way must
+ *	be cheap functions of the pixel and of state they keep for the whole
+ *	strip.
+ *
+ *	Only the bitbang driver is supported as shading is fitted into its send
+ *	loop.
+ *
+ *	@target Arduino Pro Mini (pro8MHzatmega328)
+ */
+
+#ifndef PROCEDURAL_STRIP_H
+#define PROCEDURAL_STRIP_H
+
+#include <Arduino.h>
+
+#include "clock.h"
+#include "strip.h"
+
+#if LED_DRIVER != LED_DRIVER_BITBANG
+#error "Procedural rendering needs the bitbang driver"
+#endif
+
+template<uint16_t Count, uint8_t Pin, typename Format>
+class ProceduralStrip {
+public:
+	enum : uint8_t {
+		PORT_IO = Strip<Count, Pin, Format>::PORT_IO,
+		PIN_MASK = Strip<Count, Pin, Format>::PIN_MASK
+	};
+
+	/**
+	 * Make the data pin an output
+	 */
+	void begin() {
+		pinMode(Pin, OUTPUT);
+		digitalWrite(Pin, LOW);
+	}
+
+	static uint32_t Color(uint8_t red, uint8_t green, uint8_t blue,
+			uint8_t white = 0) {
+		return Strip<Count, Pin, Format>::Color(red, green, blue, white);
+	}
+
+	/**
+	 * Set the brightness with which the next frame is shown
+	 */
+	void setBrightness(uint8_t value) {
+		brightness = value;
+	}
+
+	uint8_t getBrightness() const {
+		return brightness;
+	}
+
+	uint16_t numPixels() const {
+		return Count;
+	}
+
+	/**
+	 * Send a frame of the colors given by the shader to the strip. Interrupts
+	 * are disabled while each pixel is sent but enabled, if they were to
+	 * begin with, while the next is shaded.
+	 */
+	template<typename Shader>
+	void show(const Shader & shader) {
+		bool interrupts_enabled = SREG & _BV(SREG_I);
+		for(uint8_t attempt = 1; ; attempt++) {
+			while(clock_micros() - last_show < STRIP_LATCH_MICROS) {
+				// let the previous frame latch
+			}
+
+			bool sent = send(shader,
+					interrupts_enabled && attempt < STRIP_SHOW_ATTEMPTS);
+			last_show = clock_micros();
+			if(sent) {
+				break;
+			}
+		}
+	}
+
+private:
+	/**
+	 * Shade and send the frame, returning false if it had to be abandoned
+	 * because shading a pixel and the interrupts taken meanwhile held the
+	 * data line low too long. With interrupts disabled the gaps are not
+	 * checked; there is nothing to be gained by trying again.
+	 */
+	template<typename Shader>
+	bool send(const Shader & shader, bool allow_interrupts) {
+		uint8_t sreg = SREG;
+		uint8_t pixel[Format::CHANNELS];
+		uint16_t gap_start = TCNT1;
+		if(!allow_interrupts) {
+			cli();
+		}
+
+		for(uint16_t i = 0; i < Count; i++) {
+			uint32_t color = shader(i);
+			pixel[Format::RED] = scale8(color >> 16, brightness);
+			pixel[Format::GREEN] = scale8(color >> 8, brightness);
+			pixel[Format::BLUE] = scale8(color, brightness);
+			if(4 == Format::CHANNELS) {
+				pixel[Format::WHITE] = scale8(color >> 24, brightness);
+			}
+
+			cli();
+			// Timer1 runs free at 1us per tick (see clock.h)
+			if(allow_interrupts && 0 < i
+					&& STRIP_MAX_GAP_MICROS < (uint16_t)(TCNT1 - gap_start)) {
+				SREG = sreg;
+				return false;
+			}
+			strip_send_bytes<PORT_IO, PIN_MASK>(pixel, Format::CHANNELS);
+			gap_start = TCNT1;
+			if(allow_interrupts) {
+				SREG = sreg;
+			}
+		}
+
+		SREG = sreg;
+		return true;
+	}
+
+	uint8_t brightness = 255;
+	uint32_t last_show = 0;
+};
+
+#endif
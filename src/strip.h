@@ -0,0 +1,367 @@
+/**
+ *	A strip of NeoPixel (WS2812 or SK6812 RGBW) LED arrays whose length, data
+ *	pin and pixel format are fixed at compile time.
+ *
+ *	The Adafruit library sizes its pixel buffer at run time with `malloc`. On
+ *	a 2KB part we would rather every byte of SRAM be accounted for when the
+ *	firmware is linked, so here the pixel buffer is a member array sized by
+ *	the template and a Strip is meant to be declared as a global. With the
+ *	count, pin and format known to the compiler, channel offsets and port
+ *	addresses fold to constants and loops over the strip can be unrolled.
+ *
+ *	The interface follows Adafruit_NeoPixel so effects read the same.
+ *
+ *	@target Arduino Pro Mini (pro8MHzatmega328)
+ */
+
+#ifndef STRIP_H
+#define STRIP_H
+
+#include <Arduino.h>
+
+#include "clock.h"
+#include "math8.h"
+
+#if F_CPU != 8000000L
+#error "The strip driver is timed for an 8MHz clock"
+#endif
+
+/**
+ * How the waveform is generated. LED_DRIVER_BITBANG toggles the data pin from
+ * timed assembly and works on any pin. LED_DRIVER_SPI has the SPI peripheral
+ * shift out each bit as an eight bit symbol so the CPU only has to keep it fed
+ * and interrupts can be serviced throughout; the data pin must then be MOSI
+ * (11) and the builtin LED on SCK (13) flickers while a frame is sent.
+ */
+#define LED_DRIVER_BITBANG 0
+#define LED_DRIVER_SPI 1
+
+#ifndef LED_DRIVER
+#define LED_DRIVER LED_DRIVER_BITBANG
+#endif
+
+/**
+ * Pixel formats; how many bytes the strip expects for each pixel and the
+ * offset of each color channel within them. Being types rather than values
+ * every offset is a constant where a pixel is written.
+ */
+struct FormatRGB {
+	enum : uint8_t { CHANNELS = 3, RED = 0, GREEN = 1, BLUE = 2, WHITE = 0 };
+};
+
+struct FormatGRB {
+	enum : uint8_t { CHANNELS = 3, RED = 1, GREEN = 0, BLUE = 2, WHITE = 0 };
+};
+
+struct FormatBGR {
+	enum : uint8_t { CHANNELS = 3, RED = 2, GREEN = 1, BLUE = 0, WHITE = 0 };
+};
+
+struct FormatRGBW {
+	enum : uint8_t { CHANNELS = 4, RED = 0, GREEN = 1, BLUE = 2, WHITE = 3 };
+};
+
+struct FormatGRBW {
+	enum : uint8_t { CHANNELS = 4, RED = 1, GREEN = 0, BLUE = 2, WHITE = 3 };
+};
+
+/**
+ * The data line must be held low for at least this long between frames for
+ * the LEDs to latch what they were sent. The WS2812 datasheet says 50us but
+ * newer revisions of the part need 280us.
+ */
+#define STRIP_LATCH_MICROS 300
+
+/**
+ * Interrupts are enabled briefly between pixels so that serial input and the
+ * clock are serviced while a frame goes out; the data line sits low meanwhile.
+ * Should an interrupt keep it low for longer than this the LEDs may take it
+ * for the end of the frame, so the frame is abandoned and sent again. It must
+ * stay under the 50us that the WS2812B takes as a reset. A pixel takes 33us,
+ * or about 60us over SPI, so at 38400 baud at most one received byte is
+ * pending when the window opens.
+ */
+#define STRIP_MAX_GAP_MICROS 40
+
+/**
+ * How many times to try to send a frame with interrupts enabled between
+ * pixels before sending it with interrupts disabled throughout
+ */
+#define STRIP_SHOW_ATTEMPTS 3
+
+#if LED_DRIVER == LED_DRIVER_SPI
+/**
+ * The SPI runs at 4MHz (F_CPU / 2), 250ns a bit, and each WS2812 bit is sent
+ * as a whole SPI byte: a 0 as 0x80 (250ns high) and a 1 as 0xE0 (750ns
+ * high). The high time is what tells a 0 from a 1 and both are within the
+ * WS2812B datasheet's T0H of 400ns and T1H of 800ns, each +-150ns, though a
+ * 0 is at the bottom of its range.
+ *
+ * Four SPI bits to a WS2812 bit would send twice as fast but can not keep to
+ * the datasheet: a 1 would be 1110, low for 250ns where T1L is at least
+ * 300ns, and 1100 is high too briefly for a 1. Symbols that do not fill a
+ * byte are no better as the SPI here is not buffered; the line holds the
+ * last bit while the next byte is loaded, which would stretch a high part
+ * way through a symbol.
+ *
+ * What is given up are the low times, 1750ns after a 0 and 1250ns after a 1
+ * plus the load of the next byte, longer than the datasheet's T0L and T1L
+ * (850ns and 450ns +-150ns). As Josh Levine showed in "NeoPixels Revealed"
+ * (wp.josh.com, 2014) the LEDs tell the bits apart by the high time alone
+ * and a low only matters once it is long enough to be taken as a reset,
+ * which for the WS2812B is 50us. A pixel is sent with interrupts disabled so
+ * its lows stay at a couple of us; the gap between pixels, where interrupts
+ * get their chance, is kept under that by STRIP_MAX_GAP_MICROS as with the
+ * bitbang driver.
+ */
+#define STRIP_SPI_ZERO 0x80
+#define STRIP_SPI_ONE 0xE0
+#else
+/**
+ * Send bytes on the data pin at bit PinMask of the port at IO address PortIO.
+ * Interrupts must be disabled.
+ */
+template<uint8_t PortIO, uint8_t PinMask>
+inline void strip_send_bytes(const uint8_t * bytes, uint8_t count) {
+	// the values to write to the port for the data line to be high or low
+	// leaving the other pins on the port as they are. Taken afresh for each
+	// call as an interrupt may have changed those pins.
+	uint8_t high = _SFR_IO8(PortIO) | PinMask;
+	uint8_t low = _SFR_IO8(PortIO) & ~PinMask;
+
+	for(uint8_t j = 0; j < count; j++) {
+		uint8_t value = *bytes++;
+		uint8_t bits = 8;
+		// At 8MHz a cycle is 125ns. Every bit starts with the line going
+		// high; a 0 falls after 3 cycles (375ns) and a 1 after 7 (875ns) and
+		// the bit takes 11 cycles (1.375us) in all. The loop between bytes
+		// only stretches the low time of the last bit which the LEDs
+		// tolerate.
+#ifdef __AVR__
+		asm volatile(
+			"1:							\n\t"
+			"out	%[port], %[high]	\n\t"	// 0		rising edge
+			"nop						\n\t"	// 1
+			"sbrs	%[value], 7			\n\t"	// 2		skip if a 1
+			"out	%[port], %[low]		\n\t"	// 3		falling edge of a 0
+			"lsl	%[value]			\n\t"	// 4
+			"nop						\n\t"	// 5
+			"nop						\n\t"	// 6
+			"out	%[port], %[low]		\n\t"	// 7		falling edge of a 1
+			"dec	%[bits]				\n\t"	// 8
+			"brne	1b					\n\t"	// 9, 10
+			: [value] "+r" (value), [bits] "+r" (bits)
+			: [port] "I" (PortIO), [high] "r" (high), [low] "r" (low)
+		);
+#else
+		// built natively for the tests (see test/) there is no line to drive
+		(void)value;
+		(void)bits;
+		(void)high;
+		(void)low;
+#endif
+	}
+}
+#endif
+
+/**
+ * With two Buffers effects write the back buffer while the front buffer is
+ * what gets sent; show publishes the back buffer by swapping the two. The
+ * swap is of pointers, so it is atomic with respect to anything reading the
+ * front buffer from an interrupt, and the new back buffer is then brought up
+ * to date with a copy as effects only write what has changed. It costs a
+ * second frame of SRAM.
+ */
+template<uint16_t Count, uint8_t Pin, typename Format, uint8_t Buffers = 1>
+class Strip {
+	static_assert(1 == Buffers || 2 == Buffers, "a strip has one or two buffers");
+
+#if LED_DRIVER == LED_DRIVER_SPI
+	static_assert(11 == Pin, "the SPI driver outputs on MOSI, pin 11");
+#endif
+
+public:
+	/**
+	 * The IO address of the port the data pin is on and the pin's bit in it.
+	 * Digital pins 0-7 are PORTD, 8-13 PORTB and 14-19 (A0-A5) PORTC.
+	 */
+	enum : uint8_t {
+		PORT_IO = (Pin < 8) ? 0x0B : (Pin < 14) ? 0x05 : 0x08,
+		PIN_MASK = 1 << ((Pin < 8) ? Pin : (Pin < 14) ? Pin - 8 : Pin - 14)
+	};
+
+	/**
+	 * Make the data pin an output
+	 */
+	void begin() {
+		pinMode(Pin, OUTPUT);
+		digitalWrite(Pin, LOW);
+#if LED_DRIVER == LED_DRIVER_SPI
+		// SS must be an output for the SPI to stay master
+		pinMode(SS, OUTPUT);
+		pinMode(SCK, OUTPUT);
+#endif
+	}
+
+	/**
+	 * Pack a color as 0xWWRRGGBB. White is ignored by formats without it.
+	 */
+	static uint32_t Color(uint8_t red, uint8_t green, uint8_t blue,
+			uint8_t white = 0) {
+		return ((uint32_t)white << 24) | ((uint32_t)red << 16)
+				| ((uint16_t)green << 8) | blue;
+	}
+
+	/**
+	 * Set the brightness with which subsequent colors are written. Like the
+	 * Adafruit library the scaling happens on write, not on show.
+	 */
+	void setBrightness(uint8_t value) {
+		brightness = value;
+	}
+
+	uint8_t getBrightness() const {
+		return brightness;
+	}
+
+	/**
+	 * Write a color packed as 0xWWRRGGBB to the n-th pixel, scaled by the
+	 * brightness
+	 */
+	void setPixelColor(uint16_t n, uint32_t color) {
+		if(n < Count) {
+			uint8_t * pixel = &back[n * Format::CHANNELS];
+			pixel[Format::RED] = scale8(color >> 16, brightness);
+			pixel[Format::GREEN] = scale8(color >> 8, brightness);
+			pixel[Format::BLUE] = scale8(color, brightness);
+			if(4 == Format::CHANNELS) {
+				pixel[Format::WHITE] = scale8(color >> 24, brightness);
+			}
+		}
+	}
+
+	uint16_t numPixels() const {
+		return Count;
+	}
+
+	/**
+	 * Publish what has been written and send it to the strip. With the
+	 * bitbang driver interrupts are disabled while each pixel is sent but
+	 * enabled, if they were to begin with, between pixels; with the SPI
+	 * driver they stay enabled.
+	 */
+	void show();
+
+private:
+	bool send(bool allow_interrupts);
+
+	uint8_t pixels[Buffers][Count * Format::CHANNELS];
+	uint8_t * back = pixels[0];
+	uint8_t * front = pixels[Buffers - 1];
+	uint8_t brightness = 255;
+	uint32_t last_show = 0;
+};
+
+template<uint16_t Count, uint8_t Pin, typename Format, uint8_t Buffers>
+void Strip<Count, Pin, Format, Buffers>::show() {
+	if(2 == Buffers) {
+		uint8_t sreg = SREG;
+		cli();
+		uint8_t * published = back;
+		back = front;
+		front = published;
+		SREG = sreg;
+		memcpy(back, front, sizeof(pixels[0]));
+	}
+
+	bool interrupts_enabled = SREG & _BV(SREG_I);
+	for(uint8_t attempt = 1; ; attempt++) {
+		while(clock_micros() - last_show < STRIP_LATCH_MICROS) {
+			// let the previous frame latch
+		}
+
+		bool sent = send(interrupts_enabled && attempt < STRIP_SHOW_ATTEMPTS);
+		last_show = clock_micros();
+		if(sent) {
+			break;
+		}
+	}
+}
+
+/**
+ * Send the frame, returning false if it had to be abandoned because an
+ * interrupt held the data line low too long.
+ */
+#if LED_DRIVER == LED_DRIVER_SPI
+template<uint16_t Count, uint8_t Pin, typename Format, uint8_t Buffers>
+bool Strip<Count, Pin, Format, Buffers>::send(bool allow_interrupts) {
+	const uint8_t * pixel = front;
+	uint8_t sreg = SREG;
+	cli();
+
+	// master, MSB first, mode 0 at F_CPU / 2
+	SPCR = _BV(SPE) | _BV(MSTR);
+	SPSR = _BV(SPI2X);
+
+	for(uint16_t i = 0; i < Count; i++) {
+		for(uint8_t j = 0; j < Format::CHANNELS; j++) {
+			uint8_t value = *pixel++;
+			for(uint8_t bit = 0; bit < 8; bit++) {
+				SPDR = (value & 0x80) ? STRIP_SPI_ONE : STRIP_SPI_ZERO;
+				value <<= 1;
+				while(!(SPSR & _BV(SPIF))) {}
+			}
+		}
+
+		if(allow_interrupts && i + 1 < Count) {
+			// as for the bitbang driver below; every byte ends low so the
+			// data line is low through the gap
+			uint16_t gap_start = TCNT1;
+			sei();
+			asm volatile("nop");
+			cli();
+			if(STRIP_MAX_GAP_MICROS < (uint16_t)(TCNT1 - gap_start)) {
+				SPCR = 0;
+				SREG = sreg;
+				return false;
+			}
+		}
+	}
+
+	// release SCK to the builtin LED
+	SPCR = 0;
+	SREG = sreg;
+	return true;
+}
+#else
+template<uint16_t Count, uint8_t Pin, typename Format, uint8_t Buffers>
+bool Strip<Count, Pin, Format, Buffers>::send(bool allow_interrupts) {
+	const uint8_t * pixel = front;
+	uint8_t sreg = SREG;
+	cli();
+
+	for(uint16_t i = 0; i < Count; i++) {
+		strip_send_bytes<PORT_IO, PIN_MASK>(pixel, Format::CHANNELS);
+		pixel += Format::CHANNELS;
+
+		if(allow_interrupts && i + 1 < Count) {
+			// Timer1 runs free at 1us per tick (see clock.h). The instruction
+			// after sei always executes before any pending interrupt is taken
+			// so the nop is where interrupts get their chance.
+			uint16_t gap_start = TCNT1;
+			sei();
+			asm volatile("nop");
+			cli();
+			if(STRIP_MAX_GAP_MICROS < (uint16_t)(TCNT1 - gap_start)) {
+				SREG = sreg;
+				return false;
+			}
+		}
+	}
+
+	SREG = sreg;
+	return true;
+}
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ *	Just enough of the Arduino core, and of the AVR registers the strip
+ *	drivers touch, for the firmware's sources to be built natively and run
+ *	by the tests. The registers are plain variables; nothing is driven.
+ *	Serial reads from Serial.input and whatever is printed to it is kept in
+ *	Serial.output.
+ *
+ *	Each test suite is built as one translation unit that includes the
+ *	sources it tests, so everything here is defined in the header.
+ */
+
+#ifndef ARDUINO_STUB_H
+#define ARDUINO_STUB_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include <avr/pgmspace.h>
+
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+#define LED_BUILTIN 13
+#define SS 10
+#define SCK 13
+
+#define _BV(bit) (1 << (bit))
+#define SREG_I 7
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+
+uint8_t stub_io[64];
+uint8_t SREG;
+uint16_t TCNT1;
+uint8_t SPCR;
+uint8_t SPSR;
+uint8_t SPDR;
+uint8_t MCUSR;
+#define _SFR_IO8(address) stub_io[address]
+
+inline void cli() {
+	SREG &= ~_BV(SREG_I);
+}
+
+inline void sei() {
+	SREG |= _BV(SREG_I);
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+}
+
+struct StubSerial {
+	std::string input;
+	std::string output;
+
+	void begin(long baud) {
+	}
+
+	int available() {
+		return input.size();
+	}
+
+	int read() {
+		if(input.empty()) {
+			return -1;
+		}
+		int c = (uint8_t)input[0];
+		input.erase(0, 1);
+		return c;
+	}
+
+	void print(const char * text) {
+		output += text;
+	}
+
+	void print(char c) {
+		output += c;
+	}
+
+	void print(long value) {
+		output += std::to_string(value);
+	}
+
+	void print(unsigned long value) {
+		output += std::to_string(value);
+	}
+
+	void print(int value) {
+		print((long)value);
+	}
+
+	void print(unsigned int value) {
+		print((unsigned long)value);
+	}
+
+	template<typename T>
+	void println(T value) {
+		print(value);
+		output += "\r\n";
+	}
+};
+
+static StubSerial Serial;
+
+#endif
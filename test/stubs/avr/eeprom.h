@@ -0,0 +1,41 @@
+#ifndef EEPROM_STUB_H
+#define EEPROM_STUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The 1KB EEPROM of the ATmega328 as an array, erased to begin with.
+ * Addresses are offsets into it.
+ */
+#define E2END 0x3FF
+
+struct StubEEPROM {
+	uint8_t bytes[E2END + 1];
+
+	StubEEPROM() {
+		memset(bytes, 0xFF, sizeof(bytes));
+	}
+};
+
+static StubEEPROM stub_eeprom;
+
+inline bool eeprom_is_ready() {
+	return true;
+}
+
+inline uint8_t eeprom_read_byte(const uint8_t * address) {
+	return stub_eeprom.bytes[(uintptr_t)address];
+}
+
+inline void eeprom_write_byte(uint8_t * address, uint8_t value) {
+	stub_eeprom.bytes[(uintptr_t)address] = value;
+}
+
+inline void eeprom_read_block(void * data, const void * address,
+		size_t size) {
+	memcpy(data, &stub_eeprom.bytes[(uintptr_t)address], size);
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef PGMSPACE_STUB_H
+#define PGMSPACE_STUB_H
+
+#include <stdint.h>
+
+/**
+ * Natively there is one address space; program memory is read as any other
+ */
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+
+#endif
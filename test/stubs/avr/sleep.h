@@ -0,0 +1,21 @@
+#ifndef SLEEP_STUB_H
+#define SLEEP_STUB_H
+
+#define SLEEP_MODE_IDLE 0
+
+inline void set_sleep_mode(uint8_t mode) {
+}
+
+inline void sleep_enable() {
+}
+
+inline void sleep_disable() {
+}
+
+/**
+ * Defined by the test, which must move its clock on to the interrupt that
+ * would wake the CPU
+ */
+void sleep_cpu();
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef WDT_STUB_H
+#define WDT_STUB_H
+
+inline void wdt_disable() {
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef CRC16_STUB_H
+#define CRC16_STUB_H
+
+#include <stdint.h>
+
+/**
+ * The CRC-CCITT update of avr-libc, as its documentation gives it in C
+ */
+inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+	data ^= crc & 0xFF;
+	data ^= data << 4;
+	return (((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4)
+			^ ((uint16_t)data << 3);
+}
+
+#endif
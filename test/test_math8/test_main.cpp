@@ -0,0 +1,89 @@
+/**
+ *	The fixed point helpers of math8.h against floating point references.
+ *
+ *	Run with `pio test -e native`.
+ */
+
+#include <math.h>
+#include <unity.h>
+
+#include "math8.h"
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_scale8_by_full_scale_is_unchanged() {
+	for(uint16_t x = 0; x < 256; x++) {
+		TEST_ASSERT_EQUAL_UINT8(x, scale8(x, 255));
+		TEST_ASSERT_EQUAL_UINT8(0, scale8(x, 0));
+	}
+}
+
+void test_scale8_is_within_one_of_product() {
+	for(uint16_t x = 0; x < 256; x++) {
+		for(uint16_t f = 0; f < 256; f++) {
+			TEST_ASSERT_UINT8_WITHIN(1, x * f / 255, scale8(x, f));
+		}
+	}
+}
+
+void test_lerp8_hits_both_ends() {
+	for(uint16_t a = 0; a < 256; a++) {
+		for(uint16_t b = 0; b < 256; b++) {
+			TEST_ASSERT_EQUAL_UINT8(a, lerp8(a, b, 0));
+			TEST_ASSERT_EQUAL_UINT8(b, lerp8(a, b, 255));
+		}
+	}
+}
+
+void test_triwave8_peaks_at_half_period() {
+	TEST_ASSERT_EQUAL_UINT8(0, triwave8(0));
+	TEST_ASSERT_EQUAL_UINT8(254, triwave8(127));
+	TEST_ASSERT_EQUAL_UINT8(254, triwave8(128));
+	TEST_ASSERT_EQUAL_UINT8(0, triwave8(255));
+}
+
+void test_easing_curves_are_monotonic_from_0_to_255() {
+	uint8_t (* const curves[])(uint8_t) = {
+		ease8_in_quad, ease8_out_quad, ease8_in_out_cubic
+	};
+	for(uint8_t i = 0; i < 3; i++) {
+		TEST_ASSERT_EQUAL_UINT8(0, curves[i](0));
+		TEST_ASSERT_UINT8_WITHIN(1, 255, curves[i](255));
+		for(uint16_t x = 1; x < 256; x++) {
+			TEST_ASSERT_GREATER_OR_EQUAL_UINT8(curves[i](x - 1), curves[i](x));
+		}
+	}
+}
+
+void test_smoothstep_is_within_one_of_reference() {
+	for(uint16_t x = 0; x < 256; x++) {
+		double t = x / 255.0;
+		double reference = (3 * t * t - 2 * t * t * t) * 255;
+		TEST_ASSERT_INT_WITHIN(1, (int)lround(reference),
+				ease8_in_out_cubic(x));
+	}
+}
+
+void test_sin8_and_cos8_match_rounded_sine() {
+	for(uint16_t theta = 0; theta < 256; theta++) {
+		double angle = theta * 2 * M_PI / 256;
+		TEST_ASSERT_EQUAL_UINT8(128 + lround(127 * sin(angle)), sin8(theta));
+		TEST_ASSERT_EQUAL_UINT8(128 + lround(127 * cos(angle)), cos8(theta));
+	}
+}
+
+int main(int argc, char ** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_scale8_by_full_scale_is_unchanged);
+	RUN_TEST(test_scale8_is_within_one_of_product);
+	RUN_TEST(test_lerp8_hits_both_ends);
+	RUN_TEST(test_triwave8_peaks_at_half_period);
+	RUN_TEST(test_easing_curves_are_monotonic_from_0_to_255);
+	RUN_TEST(test_smoothstep_is_within_one_of_reference);
+	RUN_TEST(test_sin8_and_cos8_match_rounded_sine);
+	return UNITY_END();
+}
@@ -0,0 +1,187 @@
+/**
+ *	The firmware must idle the CPU whenever the strip is still and no command
+ *	is scheduled, and only then.
+ *	Here firmware.cpp runs natively, commands arriving on the stub Serial,
+ *	against a clock that moves on by the time each pass through loop takes
+ *	and, while the CPU sleeps, to the next Timer0 overflow that would wake
+ *	it. Time asleep is read back with the telemetry command.
+ *
+ *	Run with `pio test -e native`.
+ */
+
+#include <Arduino.h>
+// firmware.cpp names a local errno, which the host C library defines
+#undef errno
+
+#include <unity.h>
+
+#include "firmware.cpp"
+#include "effects.cpp"
+#include "persist.cpp"
+#include "portal.cpp"
+
+/**
+ * The time a pass through loop takes when the CPU does not sleep, in us
+ */
+#define PASS_MICROS 50
+
+/**
+ * Timer0 overflows every 2048us at 8MHz, waking the CPU if nothing else does
+ */
+#define WAKE_MICROS 2048
+
+static uint32_t now_micros = 0;
+
+/**
+ * A command to arrive while the CPU sleeps, waking it
+ */
+static std::string arriving;
+
+void clock_begin() {
+}
+
+uint32_t clock_micros() {
+	return now_micros++;
+}
+
+uint32_t clock_millis() {
+	return now_micros / 1000;
+}
+
+bool clock_reached(uint32_t deadline) {
+	return 0 <= (int32_t)(clock_millis() - deadline);
+}
+
+void sleep_cpu() {
+	if(!arriving.empty()) {
+		now_micros += 100;
+		Serial.input += arriving;
+		arriving.clear();
+	} else {
+		now_micros += WAKE_MICROS - now_micros % WAKE_MICROS;
+	}
+}
+
+/**
+ * Run loop for a number of milliseconds
+ */
+static void run(uint32_t millis) {
+	uint32_t start = clock_millis();
+	while(clock_millis() - start < millis) {
+		loop();
+		now_micros += PASS_MICROS;
+	}
+}
+
+static void send(const char * command) {
+	Serial.input += command;
+	Serial.input += "\n";
+	loop();
+}
+
+/**
+ * The milliseconds asleep and the latency of the last command to wake the
+ * CPU, as reported by telemetry
+ */
+static void telemetry(uint32_t * asleep, uint32_t * latency) {
+	Serial.output.clear();
+	send("telemetry");
+	unsigned long uptime, millis, micros;
+	TEST_ASSERT_EQUAL(3, sscanf(Serial.output.c_str(), "0 %lu %lu %lu",
+			&uptime, &millis, &micros));
+	*asleep = millis;
+	*latency = micros;
+}
+
+/**
+ * Start the command and return the milliseconds asleep over the given time
+ * after
+ */
+static uint32_t asleep_after(const char * command, uint32_t millis) {
+	uint32_t before, after, latency;
+	send(command);
+	telemetry(&before, &latency);
+	run(millis);
+	telemetry(&after, &latency);
+	return after - before;
+}
+
+void setUp() {
+	setup();
+	Serial.output.clear();
+}
+
+void tearDown() {
+}
+
+void test_still_color_sleeps() {
+	uint32_t asleep = asleep_after("color 255 0 0", 1000);
+	TEST_ASSERT_GREATER_OR_EQUAL_UINT32(950, asleep);
+}
+
+void test_dim_still_color_sleeps() {
+	uint32_t asleep = asleep_after("color 200 120 7", 1000);
+	TEST_ASSERT_GREATER_OR_EQUAL_UINT32(950, asleep);
+}
+
+void test_pulse_stays_awake() {
+	send("color 0 0 255");
+	uint32_t asleep = asleep_after("pulse", 1000);
+	TEST_ASSERT_EQUAL_UINT32(0, asleep);
+}
+
+void test_fade_sleeps_once_done() {
+	uint32_t asleep = asleep_after("fade 0 255 0 500", 1000);
+	TEST_ASSERT_GREATER_OR_EQUAL_UINT32(450, asleep);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(500, asleep);
+}
+
+void test_command_wakes_sleeping_cpu() {
+	send("color 255 0 0");
+	run(100);
+	arriving = "color 0 255 0\n";
+	run(100);
+	TEST_ASSERT_TRUE(arriving.empty());
+
+	uint32_t asleep, latency;
+	telemetry(&asleep, &latency);
+	// all that comes between waking and carrying out the command are the
+	// reads of the clock, a microsecond each
+	TEST_ASSERT_GREATER_THAN_UINT32(0, latency);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(100, latency);
+}
+
+void test_scheduled_command_runs_on_time() {
+	send("color 255 0 0");
+	run(100);
+	// Timer0 wakes the CPU every 2.048ms so over a few due times in a row
+	// some fall more than a millisecond before the next wake
+	for(uint8_t i = 0; i < 5; i++) {
+		uint32_t due = clock_millis() + 20;
+		char command[32];
+		sprintf(command, "@%lu color 0 %u 0", (unsigned long)due, i);
+		send(command);
+
+		Serial.output.clear();
+		while(Serial.output.empty() && clock_millis() < due + 100) {
+			loop();
+			now_micros += PASS_MICROS;
+		}
+		// it is due from the start of the millisecond
+		TEST_ASSERT_FALSE(Serial.output.empty());
+		TEST_ASSERT_LESS_OR_EQUAL_UINT32(1000,
+				command_received_at - due * 1000);
+		run(1 + i);
+	}
+}
+
+int main(int argc, char ** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_still_color_sleeps);
+	RUN_TEST(test_dim_still_color_sleeps);
+	RUN_TEST(test_pulse_stays_awake);
+	RUN_TEST(test_fade_sleeps_once_done);
+	RUN_TEST(test_command_wakes_sleeping_cpu);
+	RUN_TEST(test_scheduled_command_runs_on_time);
+	return UNITY_END();
+}
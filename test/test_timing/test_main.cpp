@@ -0,0 +1,134 @@
+/**
+ *	Timed effects must end when their duration is up however long each pass
+ *	through loop takes. Here effects.cpp runs natively against a clock that
+ *	the test moves on by a frame each pass, as though showing the strip and
+ *	everything else in loop took that long, and the "done" event of each
+ *	effect must come within a frame of its duration.
+ *
+ *	Run with `pio test -e native`.
+ */
+
+#include <unity.h>
+
+#include "effects.cpp"
+#include "persist.cpp"
+
+/**
+ * The clock; every read of it takes a microsecond so that waiting on it,
+ * as show does for the latch, moves on
+ */
+static uint32_t now_micros = 0;
+
+void clock_begin() {
+}
+
+uint32_t clock_micros() {
+	return now_micros++;
+}
+
+uint32_t clock_millis() {
+	return now_micros / 1000;
+}
+
+bool clock_reached(uint32_t deadline) {
+	return 0 <= (int32_t)(clock_millis() - deadline);
+}
+
+/**
+ * Run loop passes of frame microseconds each until the "done" event of the
+ * effect with the given sequence number is sent, or limit milliseconds
+ * after start. Returns the milliseconds from start to the event.
+ */
+static uint32_t run_until_done(uint32_t start, uint16_t sequence,
+		uint32_t frame, uint32_t limit) {
+	std::string done = "done " + std::to_string(sequence) + "\r\n";
+	while(clock_millis() - start < limit) {
+		effects_update();
+		if(std::string::npos != Serial.output.find(done)) {
+			return clock_millis() - start;
+		}
+		now_micros += frame;
+	}
+	return limit;
+}
+
+/**
+ * Start an effect with start_effect and check its "done" event comes at
+ * least duration and at most a frame after it started
+ */
+template<typename Start>
+static void check_duration(uint32_t duration, uint32_t frame,
+		Start start_effect) {
+	uint32_t start = clock_millis();
+	uint16_t sequence = start_effect();
+	TEST_ASSERT_NOT_EQUAL(0, sequence);
+
+	uint32_t elapsed = run_until_done(start, sequence, frame, 2 * duration);
+	TEST_ASSERT_GREATER_OR_EQUAL_UINT32(duration, elapsed);
+	// a frame and the millisecond the clock may have turned over in
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(duration + frame / 1000 + 1, elapsed);
+}
+
+void setUp() {
+	effects_begin();
+	Serial.output.clear();
+}
+
+void tearDown() {
+}
+
+void test_blink_ends_on_time() {
+	check_duration(1000, 1000, []() {
+		return effects_blink(255, 0, 0, 1000, 10, PRIORITY_DEFAULT);
+	});
+}
+
+void test_blink_ends_on_time_with_slow_frames() {
+	check_duration(1000, 7000, []() {
+		return effects_blink(255, 0, 0, 1000, 10, PRIORITY_DEFAULT);
+	});
+}
+
+void test_blink_of_more_steps_than_frames_ends_on_time() {
+	// 200 steps due every 5ms but a frame only every 16ms
+	check_duration(1000, 16000, []() {
+		return effects_blink(255, 0, 0, 1000, 100, PRIORITY_DEFAULT);
+	});
+}
+
+void test_flash_ends_on_time() {
+	check_duration(250, 3000, []() {
+		return effects_flash(0, 0, 255, 250, PRIORITY_DEFAULT);
+	});
+}
+
+void test_wipe_ends_on_time() {
+	check_duration(500, 3000, []() {
+		return effects_wipe(0, 255, 0, 500, PRIORITY_DEFAULT);
+	});
+}
+
+void test_fade_ends_on_time() {
+	check_duration(300, 5000, []() {
+		return effects_fade(0, 0, 255, 300, EASE_IN_OUT, PRIORITY_DEFAULT);
+	});
+}
+
+void test_countdown_ends_on_time() {
+	check_duration(5000, 10000, []() {
+		return effects_countdown(5000, 0, 255, 0, 1000, 255, 0, 0,
+				PRIORITY_DEFAULT);
+	});
+}
+
+int main(int argc, char ** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_blink_ends_on_time);
+	RUN_TEST(test_blink_ends_on_time_with_slow_frames);
+	RUN_TEST(test_blink_of_more_steps_than_frames_ends_on_time);
+	RUN_TEST(test_flash_ends_on_time);
+	RUN_TEST(test_wipe_ends_on_time);
+	RUN_TEST(test_fade_ends_on_time);
+	RUN_TEST(test_countdown_ends_on_time);
+	return UNITY_END();
+}